@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 import subprocess
 import argparse
+import threading
 from tqdm import tqdm
 
 '''
@@ -16,27 +17,38 @@ def check(name, trials, secret, error_rate, timeout, pass_once=False):
     trials: How many trials to run
     secret: The correct secret
     error_rate: A float between 0.0 and 1.0 indicating how much error is a success
-    timeout: How long to run a test case for before quitting (in seconds)
+    timeout: How long to allow per test case before quitting (in seconds)
     pass_once: When true, this succeeds after a single test case passes.
 
     Returns True on success, False on failure, and prints message to stdout indicating the result
     '''
     good_runs=0
+    finished=0
 
-    for i in tqdm(range(trials)):
-        p = subprocess.Popen([f'./{name}'], stdout=subprocess.PIPE)
-        try:
-                result,err = p.communicate(timeout=timeout)
-        except subprocess.TimeoutExpired:
-                print("Timeout!")
-                p.kill()
-                result,err=p.communicate()
+    # One process leaks the secret `trials` times, printing a "Trial" line per run,
+    # so calibration and setup are only paid once
+    p = subprocess.Popen(['./spectre', name, '--trials', str(trials)], stdout=subprocess.PIPE)
+    watchdog = threading.Timer(timeout * trials, p.kill)
+    watchdog.start()
 
-        if secret in result:
+    progress = tqdm(total=trials)
+    for line in p.stdout:
+        if b"Trial" not in line:
+            continue
+        finished+=1
+        progress.update(1)
+        if secret in line:
             good_runs+=1
             if pass_once:
-                trials=i+1
+                trials=finished
                 break
+    progress.close()
+
+    if not watchdog.is_alive():
+        print("Timeout!")
+    watchdog.cancel()
+    p.kill()
+    p.wait()
 
     print(f"You passed {good_runs} of {trials} runs ({(good_runs * 100.0) / trials}%)")
     if good_runs >= error_rate * trials:
@@ -0,0 +1,48 @@
+#ifndef CACHE_GEOMETRY
+#define CACHE_GEOMETRY
+#include <stddef.h>
+#include <stdbool.h>
+
+// Raspberry Pi 4 (Cortex-A72) geometry, used when neither the module nor sysfs can tell us
+#define DEFAULT_L1D_SETS 256
+#define DEFAULT_L1D_WAYS 2
+#define DEFAULT_L2_SETS 1024
+#define DEFAULT_L2_WAYS 16
+
+// Level eviction buffers, eviction sets and sweeps are sized for, unless the
+// SPECTRE_EVICTION_LEVEL environment variable names another one
+#define DEFAULT_EVICTION_LEVEL 2
+
+/*
+ * One data or unified cache.
+*/
+typedef struct
+{
+    unsigned level;
+    size_t line_size;
+    size_t sets;
+    size_t ways;
+    size_t size;
+} CacheLevel;
+
+typedef struct
+{
+    CacheLevel l1d;
+    // the cache we evict from (L2 unless SPECTRE_EVICTION_LEVEL says otherwise)
+    CacheLevel evict;
+    // where the numbers came from: "labspectrekm", "sysfs" or "defaults"
+    const char* source;
+    int cpu;
+} CacheGeometry;
+
+/*
+ * cache_geometry
+ * Geometry of the core we first ran on, discovered once: from the module's
+ * /proc/SHD_PROCFS_CACHE_NAME if it is loaded, else from
+ * /sys/devices/system/cpu/cpu<N>/cache, else the Pi 4 defaults above.
+*/
+const CacheGeometry* cache_geometry();
+
+void print_cache_geometry(const CacheGeometry* geometry);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef CALIBRATION_CACHE
+#define CALIBRATION_CACHE
+#include <stddef.h>
+#include <stdbool.h>
+#include "spectre_solution.h"
+
+// Where calibration is stored. Overridden by the SPECTRE_CALIBRATION_DIR environment variable.
+#define CALIBRATION_DEFAULT_DIR "."
+// Longest machine_key/ calibration_key
+#define CALIBRATION_KEY_LEN 512
+// Samples per memory domain used to check a loaded calibration still holds
+#define CALIBRATION_VALIDATION_SAMPLES 50
+
+/*
+ * machine_key
+ * describes the machine: CPU model, kernel release and labspectrekm module version
+*/
+void machine_key(char* key, size_t len);
+
+/*
+ * calibration_key
+ * machine_key plus the core the calibration was taken on and the timer backend,
+ * since the threshold and histograms are in that backend's ticks
+*/
+void calibration_key(char* key, size_t len);
+
+// CALIBRATION_DEFAULT_DIR, or SPECTRE_CALIBRATION_DIR when it is set
+const char* calibration_dir();
+
+bool save_cache_stats(const CacheStats* stats);
+bool load_cache_stats(CacheStats* stats);
+
+/*
+ * load_or_generate_cache_stats
+ * loads the calibration saved for this machine and core and quickly checks it.
+ * Falls back to generate_cache_stats(samples) (and saves the result) when
+ * there is no saved calibration or it no longer separates hits from misses.
+*/
+CacheStats load_or_generate_cache_stats(size_t samples);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef COVERT_CHANNEL
+#define COVERT_CHANNEL
+#include <stddef.h>
+#include <stdint.h>
+#include "parallel_leak.h"
+
+/*
+ * Raw Flush+Reload channel benchmark, with no Spectre gadget involved: a sender
+ * thread touches one probe line per symbol and a receiver thread reloads all of
+ * them, just like an attacker sweep.
+*/
+typedef struct
+{
+    // symbols to send per run
+    size_t symbols;
+} CovertConfig;
+
+/*
+ * Measured capacity of one sender/ receiver pair.
+*/
+typedef struct
+{
+    int sender_core;
+    int receiver_core;
+    size_t symbols;
+    // received as another symbol, or as no symbol at all
+    size_t errors;
+    uint64_t ns;
+    double symbols_per_second;
+    double error_rate;
+    // capacity of a 256-ary symmetric channel with this error rate
+    double bits_per_symbol;
+    double bits_per_second;
+} CovertResult;
+
+#define COVERT_DEFAULT_SYMBOLS 100000
+
+/*
+ * measure_covert_channel
+ * sends config->symbols pseudo random symbols over shared_memory from a thread
+ * pinned to sender_core to one pinned to receiver_core. Hits are decided with
+ * the calibrated threshold.
+*/
+CovertResult measure_covert_channel(char* shared_memory, uint64_t threshold, int sender_core, int receiver_core,
+                                    const CovertConfig* config);
+
+/*
+ * run_covert_channel
+ * Measures the channel with sender and receiver on the same core, then on two
+ * different cores: the first two of parallel->cores when given, else the current
+ * core and the next one. Prints one line per pair.
+ *
+ * Returns: EXIT_SUCCESS
+*/
+int run_covert_channel(char* shared_memory, const ParallelConfig* parallel, const CovertConfig* config);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef EVICTION_PROFILE
+#define EVICTION_PROFILE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "parallel_leak.h"
+
+/*
+ * Which sets of the eviction buffer to walk, and how often.
+*/
+typedef struct
+{
+    // sets [first_set, last_set) of the eviction level (see cache_geometry()) are
+    // walked, one checkpoint every step sets
+    size_t first_set;
+    size_t last_set;
+    size_t step;
+    // passes over the whole range
+    size_t trials;
+} EvictionProfileConfig;
+
+EvictionProfileConfig default_eviction_profile_config();
+
+/*
+ * parse_profile_range
+ * parses "FIRST:LAST:STEP" (STEP may be left out) into config
+*/
+bool parse_profile_range(const char* range, EvictionProfileConfig* config);
+
+/*
+ * run_eviction_profile
+ * Measures which parts of the eviction buffer evict a target line.
+ *
+ * Every trial loads the target once and makes a single pass over the range.
+ * At each checkpoint it times the target, which brings it back into the cache,
+ * so each checkpoint's latency shows whether the sets walked since the previous
+ * checkpoint (every way of each) evicted it. Total work is linear in the range.
+ *
+ * With parallel->num_workers > 0 the trials are split across workers pinned to
+ * those cores, each with its own target and eviction buffer.
+ *
+ * Writes one CSV row per core and checkpoint with latency percentiles to out.
+*/
+void run_eviction_profile(const EvictionProfileConfig* config, const ParallelConfig* parallel, FILE* out);
+
+#endif
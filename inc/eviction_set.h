@@ -0,0 +1,51 @@
+#ifndef EVICTION_SET
+#define EVICTION_SET
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Smallest line size of the caches we target. The real geometry of the
+// cache we evict from comes from cache_geometry() at runtime.
+#define CACHE_LINE_SIZE 64
+
+// Upper bound on lines in a set. Large enough to hold every line of the
+// eviction buffer that shares one page offset (the fallback without pagemap).
+#define EVSET_MAX_LINES 512
+
+/*
+ * A list of lines that, when accessed, evict everything
+ * else that maps to the same cache set(s).
+*/
+typedef struct
+{
+    size_t size;
+    char* lines[EVSET_MAX_LINES];
+} EvictionSet;
+
+/*
+ * virt_to_phys
+ * translates addr using /proc/self/pagemap.
+ * Returns 0 if pagemap isn't readable (or hides PFNs, as it does without CAP_SYS_ADMIN)
+*/
+uint64_t virt_to_phys(void* addr);
+bool pagemap_available();
+
+// Set of the eviction level (see cache_geometry()) that a physical address maps to
+size_t evict_set_index(uint64_t phys_addr);
+
+/*
+ * build_eviction_set_for_page_offset
+ * builds a set evicting every set of the eviction level that an address with this
+ * page offset could map to, for targets we can't time (e.g. kernel variables).
+ * With pagemap that is one line per way for each possible set, otherwise
+ * every eviction buffer line with that page offset.
+*/
+void build_eviction_set_for_page_offset(size_t page_offset, EvictionSet* out);
+
+/*
+ * evict_with_set
+ * accesses every line of the set
+*/
+void evict_with_set(const EvictionSet* set);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef HUGE_BUFFER
+#define HUGE_BUFFER
+#include <stddef.h>
+#include <stdbool.h>
+
+#define HUGE_PAGE_SIZE (1 << 21)
+
+/*
+ * What ended up backing a buffer, best first.
+*/
+typedef enum
+{
+    // MAP_HUGETLB, needs pages reserved in /proc/sys/vm/nr_hugepages
+    BUFFER_HUGETLB,
+    // transparent huge pages through madvise(MADV_HUGEPAGE)
+    BUFFER_THP,
+    // plain 4 KB pages
+    BUFFER_SMALL_PAGES,
+} BufferBacking;
+
+/*
+ * An aligned, pre-faulted buffer for the eviction buffer or probe region.
+*/
+typedef struct
+{
+    char* addr;
+    size_t size;
+    BufferBacking backing;
+    // bytes of the buffer the kernel reports as huge page backed (from smaps)
+    size_t huge_bytes;
+    // physically contiguous according to pagemap (false if pagemap hides PFNs)
+    bool contiguous;
+    bool pagemap_checked;
+
+    // the whole mapping, including the slack used for alignment
+    void* mapping;
+    size_t mapping_size;
+} HugeBuffer;
+
+/*
+ * allocate_huge_buffer
+ * maps size bytes aligned to HUGE_PAGE_SIZE, trying hugetlbfs, then THP, then 4 KB pages,
+ * populates and touches every page and checks what it got. Exits if even 4 KB pages can't be mapped.
+*/
+HugeBuffer allocate_huge_buffer(size_t size);
+
+void free_huge_buffer(HugeBuffer* buffer);
+
+const char* buffer_backing_name(BufferBacking backing);
+
+/*
+ * print_huge_buffer
+ * one line describing where the buffer is and what backs it
+*/
+void print_huge_buffer(const char* name, const HugeBuffer* buffer);
+
+#endif
@@ -13,6 +13,8 @@
 #include <stdint.h>
 #include <sys/mman.h>
 
+#include "labspectreipc.h"
+
 /********************************************
  * SHD Spectre Lab Userspace Helper Methods *
  ********************************************/
@@ -45,12 +47,32 @@ void evict_address(void* addr);
 void init_shared_memory(char *shared_memory, size_t len);
 
 /*
- * run_attacker
+ * register_shared_memory
+ * Asks the kernel to pin and map shared_memory once for this file descriptor,
+ * so later commands don't pay for pinning and mapping it on every write.
  *
  * Arguments:
  *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
- *  - shared_memory: A pointer to a region of memory shared with the server
+ *  - shared_memory: The region that will be passed as arg1 of later commands
+ *  - num_pages: How many of its pages to pin (0 for all of them). Later commands can
+ *    only use bit-fields whose probe lines fall in these pages.
+ *
+ * Returns: None
+ */
+void register_shared_memory(int kernel_fd, char *shared_memory, size_t num_pages);
+
+/*
+ * submit_command_batch
+ * Sends several commands to the kernel using as few write() calls as possible.
+ * Commands are split into batches of at most SHD_SPECTRE_LAB_MAX_BATCH_LEN.
+ *
+ * Arguments:
+ *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
+ *  - cmds: The commands to run, in order. They must all share the same arg1.
+ *  - count: Number of commands in cmds
+ *
+ * Returns: None
  */
-int run_attacker(int kernel_fd, char *shared_memory);
+void submit_command_batch(int kernel_fd, const spectre_lab_command *cmds, size_t count);
 
 #endif // SHD_SPECTRE_LAB_H
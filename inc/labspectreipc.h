@@ -7,6 +7,20 @@
 // Name of the victim file in /proc/
 #define SHD_PROCFS_NAME "labspectre-victim"
 
+// Name of the victim handler statistics file in /proc/ (write anything to reset)
+#define SHD_PROCFS_STATS_NAME "labspectre-stats"
+
+// Name of the secret store file in /proc/. Reads "<size> <seed>" of the current store,
+// writing "<size> <seed>" refills it (root only, a size of 0 frees it)
+#define SHD_PROCFS_SECRET_NAME "labspectre-secret"
+
+// Name of the cache geometry file in /proc/. One line per core and cache:
+// "<cpu> <level> <data|instruction|unified> <line size> <sets> <ways> <size in bytes>"
+#define SHD_PROCFS_CACHE_NAME "labspectre-cache"
+
+// Most cache levels CLIDR_EL1 can describe
+#define SHD_SPECTRE_LAB_MAX_CACHE_LEVELS ((7))
+
 #define SHD_SPECTRE_LAB_PAGE_SIZE ((0x1000))
 
 // How many pages should be shared between the client and server?
@@ -18,10 +32,85 @@
 // Maximum secret length (in bytes)
 #define SHD_SPECTRE_LAB_SECRET_MAX_LEN ((64))
 
+// Largest secret store the victim will allocate (in bytes)
+#define SHD_SPECTRE_LAB_STORE_MAX_SIZE ((64 << 20))
+
+// Marks a write as a batch of commands instead of a single command ("BTCH")
+#define SHD_SPECTRE_LAB_BATCH_MAGIC ((0x48435442))
+
+// Maximum number of commands the kernel will run from a single batched write
+#define SHD_SPECTRE_LAB_MAX_BATCH_LEN ((64))
+
+// Oracle records each open victim file keeps when oracle mode is on (older ones are overwritten)
+#define SHD_SPECTRE_LAB_ORACLE_LEN ((1024))
+
+// Oracle target of a command that touched no probe line
+#define SHD_SPECTRE_LAB_ORACLE_NO_TARGET ((-1))
+
+// Number of PMU event counters (PMEVCNTR0-3_EL0) the module programs on every core
+#define SHD_SPECTRE_LAB_PMU_EVENT_COUNTERS ((4))
+
+// Default events for those counters (ARMv8 common event numbers)
+#define SHD_PMU_EVENT_L1D_CACHE_REFILL ((0x03))
+#define SHD_PMU_EVENT_L1D_TLB_REFILL ((0x05))
+#define SHD_PMU_EVENT_BR_MIS_PRED ((0x10))
+#define SHD_PMU_EVENT_L2D_CACHE_REFILL ((0x17))
+
+/*
+ * Command flags
+ */
+
+// This command only trains the branch predictor. After running it, the kernel
+// flushes the shared memory region so the training access does not show up
+// when probing the result of the attack command that follows it.
+#define SHD_SPECTRE_LAB_FLAG_TRAIN ((1 << 0))
+
+// Read the secret from the secret store instead of the part's fixed secret.
+// arg2 may then be any offset below the size of the store.
+#define SHD_SPECTRE_LAB_FLAG_STORE ((1 << 1))
+
+// Encode only a bit-field of the secret byte: the gadget accesses probe line
+// (secret >> shift) & ((1 << width) - 1) instead of line secret, so a command
+// only needs the first 1 << width pages. Width is 1, 2 or 4 bits and the field
+// must fit in the byte. A width of 0 (no field flags) encodes the whole byte.
+#define SHD_SPECTRE_LAB_FLAG_FIELD(width, shift) (((((width) & 0xf) << 8) | (((shift) & 0x7) << 12)))
+#define SHD_SPECTRE_LAB_FIELD_WIDTH(flags) (((((flags) >> 8) & 0xf)))
+#define SHD_SPECTRE_LAB_FIELD_SHIFT(flags) (((((flags) >> 12) & 0x7)))
+
+// Number of probe lines a command with these flags can access
+#define SHD_SPECTRE_LAB_FIELD_LINES(flags) \
+	((SHD_SPECTRE_LAB_FIELD_WIDTH(flags) ? (1 << SHD_SPECTRE_LAB_FIELD_WIDTH(flags)) : SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES))
+
+// Probe line that encodes the secret byte under these flags
+#define SHD_SPECTRE_LAB_FIELD(secret, flags) \
+	(((((unsigned char)(secret)) >> SHD_SPECTRE_LAB_FIELD_SHIFT(flags)) & (SHD_SPECTRE_LAB_FIELD_LINES(flags) - 1)))
+
+// Whether the field flags describe a bit-field the victim supports
+#define SHD_SPECTRE_LAB_FIELD_VALID(flags) \
+	((SHD_SPECTRE_LAB_FIELD_WIDTH(flags) == 0 ? SHD_SPECTRE_LAB_FIELD_SHIFT(flags) == 0 : \
+		((SHD_SPECTRE_LAB_FIELD_WIDTH(flags) == 1 || SHD_SPECTRE_LAB_FIELD_WIDTH(flags) == 2 || \
+		  SHD_SPECTRE_LAB_FIELD_WIDTH(flags) == 4) && \
+		 SHD_SPECTRE_LAB_FIELD_SHIFT(flags) + SHD_SPECTRE_LAB_FIELD_WIDTH(flags) <= 8)))
+
 /*********************************************************
  * SHD Spectre Lab Shared Structures (Kernel/ Userspace) *
  *********************************************************/
 
+/*
+ * shd_spectre_lab_store_byte
+ * Byte `index` of a secret store filled from `seed`. Every 8 byte block is the
+ * splitmix64 output for its block number, so user space can regenerate any
+ * range of the store on its own to check what it leaked.
+ */
+static inline unsigned char shd_spectre_lab_store_byte(uint64_t seed, uint64_t index)
+{
+	uint64_t z = seed + ((index >> 3) + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z = z ^ (z >> 31);
+	return (unsigned char)(z >> (8 * (index & 7)));
+}
+
 // "IPC" is a bit of a misnomer, as we now target the kernel instead of another process
 
 /*
@@ -36,7 +125,16 @@ typedef enum {
 	COMMAND_PART2,
 
 	// Run the second vulnerable method (vulnerable to spectre) but harder! (Part 3)
-	COMMAND_PART3
+	COMMAND_PART3,
+
+	// Pin and map the shared memory region at arg1 once for this open file.
+	// Later commands using the same arg1 reuse that mapping. arg2 is the number
+	// of pages to pin (0 for all SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES), enough
+	// for the SHD_SPECTRE_LAB_FIELD_LINES of every later command.
+	COMMAND_REGISTER_SHARED_MEMORY,
+
+	// Release the region pinned by COMMAND_REGISTER_SHARED_MEMORY
+	COMMAND_UNREGISTER_SHARED_MEMORY
 } spectre_lab_command_kind;
 
 /*
@@ -47,6 +145,9 @@ typedef struct spectre_lab_command_t {
 	// What kind of command is this?
 	spectre_lab_command_kind kind;
 
+	// Bitwise OR of SHD_SPECTRE_LAB_FLAG_* values (0 for a normal command)
+	uint32_t flags;
+
 	// Usually this is the user virtual address of the shared memory region
 	uint64_t arg1;
 
@@ -54,4 +155,42 @@ typedef struct spectre_lab_command_t {
 	uint64_t arg2;
 } spectre_lab_command;
 
+/*
+ * spectre_lab_batch_header
+ * Prefix of a batched write. It is followed by `count` spectre_lab_command
+ * structs, which the kernel runs back-to-back in a single write() call.
+ * Every command in a batch must use the same shared memory region (arg1).
+ */
+typedef struct spectre_lab_batch_header_t {
+	// Must be SHD_SPECTRE_LAB_BATCH_MAGIC
+	uint32_t magic;
+
+	// Number of commands following this header (at most SHD_SPECTRE_LAB_MAX_BATCH_LEN)
+	uint32_t count;
+} spectre_lab_batch_header;
+
+/*
+ * spectre_lab_oracle_record
+ * Ground truth for one command, logged by the victim in oracle mode and
+ * returned by read() on the victim file, oldest first.
+ */
+typedef struct spectre_lab_oracle_record_t {
+	// Increments by one per logged command on this open file, so gaps mean records were overwritten
+	uint64_t sequence;
+
+	// The command's kind and flags
+	spectre_lab_command_kind kind;
+	uint32_t flags;
+
+	// The command's secret offset (arg2)
+	uint64_t offset;
+
+	// Probe line (page of the shared memory region) the gadget accessed, or
+	// SHD_SPECTRE_LAB_ORACLE_NO_TARGET
+	int32_t target;
+
+	// 1 if the access was architectural (passed the bounds check), 0 if only speculative
+	uint32_t architectural;
+} spectre_lab_oracle_record;
+
 #endif // SHD_SPECTRE_LAB_IPC_H
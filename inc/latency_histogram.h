@@ -0,0 +1,48 @@
+#ifndef LATENCY_HISTOGRAM
+#define LATENCY_HISTOGRAM
+#include <stddef.h>
+#include <stdint.h>
+
+// One bucket per cycle. Anything slower lands in the last bucket.
+#define HISTOGRAM_BUCKETS 1024
+
+/*
+ * Fixed size latency histogram. Uses constant memory no matter
+ * how many samples are added.
+*/
+typedef struct
+{
+    uint64_t count;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+} LatencyHistogram;
+
+void histogram_reset(LatencyHistogram* hist);
+void histogram_add(LatencyHistogram* hist, uint64_t latency);
+
+/*
+ * histogram_decay
+ * halves every bucket so new samples outweigh old ones
+*/
+void histogram_decay(LatencyHistogram* hist);
+
+/*
+ * histogram_percentile
+ * returns the smallest latency at or below which `percent` (0-100) of the samples fall
+*/
+uint64_t histogram_percentile(const LatencyHistogram* hist, double percent);
+
+/*
+ * histogram_otsu_threshold
+ * treats hits and misses as one bimodal distribution and returns the
+ * split latency that maximizes the between-class variance (Otsu's method).
+ * Latencies <= the result are classified as hits.
+*/
+uint64_t histogram_otsu_threshold(const LatencyHistogram* hits, const LatencyHistogram* misses);
+
+/*
+ * histogram_print
+ * prints the non-empty buckets as "[latency:count,...]"
+*/
+void histogram_print(const LatencyHistogram* hist);
+
+#endif
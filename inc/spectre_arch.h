@@ -0,0 +1,52 @@
+#ifndef SPECTRE_ARCH
+#define SPECTRE_ARCH
+
+/*
+ * Architecture specific cache maintenance and barriers, so the
+ * userspace code also builds (and can be benchmarked) on x86 machines.
+*/
+
+#if !defined(__aarch64__) && !defined(__x86_64__)
+#error "Unsupported architecture: only aarch64 and x86_64 are supported"
+#endif
+
+/*
+ * arch_flush_line
+ * evicts the line containing addr to the point of coherency
+*/
+static inline void arch_flush_line(void* addr)
+{
+#if defined(__aarch64__)
+    asm volatile("dc civac, %0"::"r"(addr));
+#else
+    asm volatile("clflush (%0)"::"r"(addr));
+#endif
+}
+
+/*
+ * arch_memory_barrier
+ * waits for all outstanding memory accesses and cache maintenance
+*/
+static inline void arch_memory_barrier(void)
+{
+#if defined(__aarch64__)
+    asm volatile("dsb sy" ::: "memory");
+#else
+    asm volatile("mfence" ::: "memory");
+#endif
+}
+
+/*
+ * arch_instruction_barrier
+ * keeps later instructions from starting before earlier ones complete
+*/
+static inline void arch_instruction_barrier(void)
+{
+#if defined(__aarch64__)
+    asm volatile("isb" ::: "memory");
+#else
+    asm volatile("lfence" ::: "memory");
+#endif
+}
+
+#endif
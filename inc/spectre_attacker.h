@@ -0,0 +1,62 @@
+#ifndef SPECTRE_ATTACKER
+#define SPECTRE_ATTACKER
+#include "spectre_solution.h"
+#include "spectre_probe.h"
+#include "spectre_decision.h"
+
+/*
+ * Everything that differs between the parts. Each attacker-partN.c defines one,
+ * so all three parts can live in a single binary.
+*/
+typedef struct
+{
+    // subcommand name, e.g. "part1"
+    const char* name;
+    // prefix for output lines, e.g. "Part 1"
+    const char* label;
+    // print every byte as it is leaked
+    bool print_bytes;
+
+    /*
+     * setup
+     * Describes how this part probes the victim, so the attacker, the benchmark
+     * and other drivers share one configuration.
+     *
+     * Arguments:
+     *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
+     *  - shared_memory: The probe region registered with kernel_fd
+     *  - cache_stats: Calibration to take the hit threshold from
+     *  - probe: Filled in with how to run a sweep
+     *  - decision: Filled in with when to commit to a byte
+     */
+    void (*setup)(int kernel_fd, char *shared_memory, const CacheStats *cache_stats,
+                  ProbeConfig *probe, DecisionConfig *decision);
+
+    // Releases anything setup allocated for probe
+    void (*teardown)(ProbeConfig *probe);
+} AttackerPart;
+
+extern const AttackerPart attacker_part1;
+extern const AttackerPart attacker_part2;
+extern const AttackerPart attacker_part3;
+
+/*
+ * find_attacker_part
+ * looks a part up by name ("part1", "part2", "part3"). Returns NULL if unknown.
+*/
+const AttackerPart* find_attacker_part(const char* name);
+
+/*
+ * run_attacker
+ * Leaks the secret `trials` times, reusing calibration, the probe region and
+ * the eviction buffer across trials. Prints one result line per trial.
+ *
+ * Arguments:
+ *  - part: Which part to attack
+ *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
+ *  - shared_memory: A pointer to a region of memory shared with the server
+ *  - trials: How many times to leak the secret
+*/
+int run_attacker(const AttackerPart* part, int kernel_fd, char *shared_memory, size_t trials);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef SPECTRE_BENCH
+#define SPECTRE_BENCH
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "labspectreipc.h"
+#include "spectre_attacker.h"
+
+/*
+ * Throughput and accuracy benchmark of one part against a known secret.
+*/
+typedef struct
+{
+    // how many times to leak the whole secret
+    size_t trials;
+    // the secret the victim holds, used to score every leaked byte (NULL: the stock module's)
+    const char* secret;
+    // where to write the JSON report
+    FILE* out;
+    // single sweeps per secret byte and trial scored against the victim's oracle (0: don't score)
+    size_t oracle_sweeps;
+    // bytes of the victim's secret store to leak per trial instead of the secret (0: use the secret)
+    size_t store_bytes;
+    // seed the secret store is filled from
+    uint64_t store_seed;
+} BenchConfig;
+
+// Oracle sweeps per secret byte and trial unless --oracle-sweeps says otherwise
+#define BENCH_DEFAULT_ORACLE_SWEEPS 16
+
+// Secret store benchmarks report throughput over this many equal windows of the run
+#define BENCH_STORE_WINDOWS 32
+
+// Secret the stock module holds for each part
+const char* default_bench_secret(spectre_lab_command_kind kind);
+
+/*
+ * run_benchmark
+ * Leaks the secret config->trials times in this process and writes a JSON report with
+ * bytes/sec, sweeps, victim calls and timer ticks per byte (with percentiles),
+ * and the per-byte error rate. If the victim has an oracle (see enable_victim_oracle),
+ * the report also scores single sweeps against the probe line the victim really targeted.
+ *
+ * With config->store_bytes set it leaks that many bytes of the victim's secret store
+ * instead (filled from config->store_seed first), and also reports throughput over
+ * BENCH_STORE_WINDOWS windows of the run and the steady state bytes/sec.
+ *
+ * Returns: EXIT_SUCCESS, or EXIT_FAILURE if the secret store couldn't be filled
+*/
+int run_benchmark(const AttackerPart* part, int kernel_fd, char* shared_memory, const BenchConfig* config);
+
+#endif
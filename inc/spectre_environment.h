@@ -0,0 +1,96 @@
+#ifndef SPECTRE_ENVIRONMENT
+#define SPECTRE_ENVIRONMENT
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// No core given: stay on the core we started on
+#define ENVIRONMENT_CURRENT_CORE -1
+// Core frequency below this fraction of the maximum (after warming up) gets a warning
+#define ENVIRONMENT_MIN_FREQ_FRACTION 0.95
+// Busy time before the frequency is read, so on-demand governors have ramped up
+#define ENVIRONMENT_WARMUP_MS 50
+
+/*
+ * How the attacker process is set up before anything is timed.
+*/
+typedef struct
+{
+    // pin to a core, so sweeps don't migrate and the victim thread shares our caches
+    bool pin;
+    // core to pin to, or ENVIRONMENT_CURRENT_CORE
+    int core;
+    // SCHED_FIFO priority (0: keep the normal policy). Threads started later inherit it.
+    int fifo_priority;
+    // mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT), so no probe or eviction page is ever paged out
+    bool lock_memory;
+} EnvironmentConfig;
+
+/*
+ * What setup_environment got, and what it found about the core.
+*/
+typedef struct
+{
+    // core we ended up on
+    int core;
+    bool pinned;
+    bool fifo;
+    bool memory_locked;
+    // cpufreq governor of the core ("" if cpufreq isn't exposed)
+    char governor[32];
+    // frequencies in kHz (0 if unknown). cur_khz is read after ENVIRONMENT_WARMUP_MS of spinning.
+    unsigned long idle_khz;
+    unsigned long cur_khz;
+    unsigned long max_khz;
+    // other logical CPUs sharing the physical core that are online
+    size_t smt_siblings;
+    // noise sources reported by setup_environment
+    size_t warnings;
+} EnvironmentReport;
+
+// Filled in from the command line by main
+extern EnvironmentConfig environment_config;
+// Filled in by setup_environment
+extern EnvironmentReport environment_report;
+
+/*
+ * parse_fifo_priority
+ * parses a SCHED_FIFO priority within the range the kernel accepts
+*/
+bool parse_fifo_priority(const char* arg, int* out);
+
+/*
+ * parse_pin_core
+ * parses a core number below the number of configured CPUs
+*/
+bool parse_pin_core(const char* arg, int* out);
+
+/*
+ * pin_to_core
+ * pins the calling thread to core. Returns false (with errno set) if it can't.
+*/
+bool pin_to_core(int core);
+
+/*
+ * next_allowed_core
+ * the next core after core (wrapping around) that the process was allowed to run
+ * on before setup_environment pinned it, or core itself if there is no other
+*/
+int next_allowed_core(int core);
+
+/*
+ * setup_environment
+ * Pins the calling thread, switches it to SCHED_FIFO and locks memory as config
+ * asks, then checks the core's frequency scaling and SMT siblings. Prints one line
+ * describing the result and a warning for everything likely to add timing noise.
+ * Failures are warnings too: the attack still runs, just noisier.
+*/
+void setup_environment(const EnvironmentConfig* config);
+
+/*
+ * print_json_environment
+ * environment_report as the "environment" member of a JSON object (with trailing comma)
+*/
+void print_json_environment(FILE* out);
+
+#endif
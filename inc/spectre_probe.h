@@ -0,0 +1,90 @@
+#ifndef SPECTRE_PROBE
+#define SPECTRE_PROBE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "labspectre.h"
+#include "labspectreipc.h"
+#include "eviction_set.h"
+
+// Number of probe lines (one per page of shared memory, one per possible byte value)
+#define PROBE_NUM_LINES SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES
+
+// Bits of the secret byte every victim call encodes (1, 2 or 4, or 0 for the whole byte).
+// Filled in from the command line by main.
+extern size_t probe_field_bits;
+
+/*
+ * parse_probe_radix
+ * parses the number of probe lines per sweep, "2", "4", "16" or "256", into the
+ * matching field width
+*/
+bool parse_probe_radix(const char* radix, size_t* field_bits);
+
+/*
+ * probe_field_lines
+ * number of probe lines a field of field_bits bits needs (PROBE_NUM_LINES for 0)
+*/
+size_t probe_field_lines(size_t field_bits);
+
+/*
+ * Describes how one sweep should invoke the victim.
+*/
+typedef struct
+{
+    // file descriptor of the victim and the probe region registered with it
+    int kernel_fd;
+    char *shared_memory;
+    // which gadget to attack
+    spectre_lab_command_kind kind;
+    // number of in-bounds training calls made before every attack call
+    size_t num_training;
+    // number of eviction passes between training and the attack call.
+    // When 0, training and attack are sent to the victim in a single batch.
+    size_t evict_repeats;
+    // lines to evict with on each pass, or NULL to sweep the whole cache with evict_all_cache()
+    const EvictionSet *eviction_set;
+    // bits of the secret byte each victim call encodes (1, 2 or 4), or 0 for the whole byte.
+    // A sweep then only uses the first probe_field_lines(field_bits) probe lines.
+    size_t field_bits;
+    // lowest bit of the field probe_sweep leaks (decide_byte steps through them)
+    size_t field_shift;
+    // leak offsets of the victim's secret store (configure_secret_store) instead of the part's secret
+    bool secret_store;
+} ProbeConfig;
+
+/*
+ * probe_num_lines
+ * number of probe lines one sweep of config flushes and reloads
+*/
+size_t probe_num_lines(const ProbeConfig *config);
+
+/*
+ * flush_probe_lines
+ * flushes the first num_lines probe lines of shared_memory, followed by a single barrier
+*/
+void flush_probe_lines(char *shared_memory, size_t num_lines);
+
+/*
+ * reload_probe_lines
+ * times an access to each of the first num_lines probe lines (a power of two).
+ * timings[i] is the latency of line i. Lines are visited in a scrambled order
+ * so the prefetcher can't help.
+*/
+void reload_probe_lines(char *shared_memory, uint64_t timings[PROBE_NUM_LINES], size_t num_lines);
+
+/*
+ * probe_sweep
+ * One Flush+Reload sweep: flush the probe lines, make one victim call
+ * (plus optional training calls), then reload and time the probe lines.
+ * Only the first probe_num_lines(config) entries of timings are filled in.
+*/
+void probe_sweep(const ProbeConfig *config, size_t offset, uint64_t timings[PROBE_NUM_LINES]);
+
+/*
+ * probe_fastest_line
+ * returns the index of the probe line with the lowest latency among the first num_lines
+*/
+size_t probe_fastest_line(const uint64_t timings[PROBE_NUM_LINES], size_t num_lines);
+
+#endif
@@ -7,10 +7,24 @@
 #include <stdio.h>
 #include <assert.h>
 #include "labspectre.h"
+#include "latency_histogram.h"
 
 // Repeat any statement of block by placing macro infront. i.e REPEAT(2) i++;
 #define REPEAT(x) for(int repeat_idx_##x=0; repeat_idx_##x < x; repeat_idx_##x++)
 
+/*
+ * next_random
+ * one xorshift64 step: advances *state (which must not be 0) and returns it.
+ * For reproducible test data, not for anything that needs good randomness.
+*/
+static inline uint64_t next_random(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
 /*
  * Generate Statistics about the cache in order to perform
  * a side-channel attack.
@@ -19,29 +33,48 @@ typedef struct
 {
     // number of samples we take for each memory domain
     size_t num_samples;
-    // dynamically allocated lists containing latencies for accessing an address
-    // in a given memory domain. Each element is a seperate time trial
-    uint64_t *l1_samples, *l2_samples, *dram_samples;
-    // the average latency for l1, l2, and dram
+    // latency histograms for accessing an address in a given memory domain
+    LatencyHistogram l1_hist, l2_hist, dram_hist;
+    // the median latency for l1, l2, and dram
     uint64_t l1, l2, dram;
+    // latencies <= threshold are cache hits, chosen from the l2 and dram histograms
+    uint64_t threshold;
 } CacheStats;
 
+// Attackers refresh their calibration every RECALIBRATION_INTERVAL leaked bytes
+#define RECALIBRATION_INTERVAL 8
+#define RECALIBRATION_SAMPLES 100
+
 CacheStats generate_cache_stats(size_t samples);
 void destroy_cache_stats(CacheStats stats);
 void print_cache_stats(CacheStats stats);
 
 /*
- * evict_all_cache
- * evicts all the lines from cache
+ * recalibrate_cache_stats
+ * Decays the existing histograms, adds `samples` fresh samples per
+ * memory domain and recomputes the medians and the hit threshold.
+ * Meant to be called periodically while an attack is running.
 */
-void evict_all_cache();
+void recalibrate_cache_stats(CacheStats* stats, size_t samples);
 
 /*
- * print_numpy_eviction_set_graph
- * prints python code that when executed produces 
- * a matplotlib graph, relating the number of eviction sets
- * accessed and the latency of an access
+ * validate_cache_stats
+ * Takes a few fresh samples and checks that stats->threshold still
+ * separates L2 hits from DRAM accesses.
 */
-void print_python_eviction_set_graph();
+bool validate_cache_stats(const CacheStats* stats, size_t samples);
+
+/*
+ * get_eviction_buffer
+ * buffer whose lines are used to evict the cache (also the eviction set candidate pool)
+*/
+char* get_eviction_buffer();
+size_t get_eviction_buffer_size();
+
+/*
+ * evict_all_cache
+ * evicts all the lines from cache
+*/
+void evict_all_cache();
 
 #endif
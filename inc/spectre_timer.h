@@ -0,0 +1,68 @@
+#ifndef SPECTRE_TIMER
+#define SPECTRE_TIMER
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Backend used when none is selected at runtime. Override with make TIMER=<name>.
+#ifndef SPECTRE_DEFAULT_TIMER
+#define SPECTRE_DEFAULT_TIMER "auto"
+#endif
+
+/*
+ * A way of timing a single memory access.
+*/
+typedef struct
+{
+    const char* name;
+    // returns false if the backend can't be used on this machine/ kernel
+    bool (*init)(void);
+    // reads the raw counter
+    uint64_t (*read)(void);
+    // times one load of addr, with whatever fencing the backend needs
+    uint64_t (*time_access)(void* addr);
+    // times one load of each base + offsets[i] into latencies[i], or NULL to loop over time_access
+    void (*reload_lines)(char* base, const uint32_t* offsets, uint64_t* latencies, size_t count);
+} TimerBackend;
+
+/*
+ * Overhead and resolution of a backend, measured at startup.
+*/
+typedef struct
+{
+    // median time_access() of an L1 hit, in ticks
+    uint64_t overhead;
+    // smallest non-zero difference between two back-to-back reads, in ticks
+    uint64_t resolution;
+    // how fast the counter runs compared to wall clock time
+    double ticks_per_ns;
+} TimerProperties;
+
+/*
+ * select_timer_backend
+ * makes name the backend used by time_access(). "auto" picks the first available
+ * backend in order of preference. Returns false if name is unknown or unavailable.
+*/
+bool select_timer_backend(const char* name);
+
+// The backend currently used by time_access()
+const TimerBackend* active_timer_backend();
+
+/*
+ * time_access_lines
+ * times one load of every base + offsets[i] into latencies[i] with the active backend
+*/
+void time_access_lines(char* base, const uint32_t* offsets, uint64_t* latencies, size_t count);
+
+TimerProperties measure_timer_backend(const TimerBackend* backend);
+
+// Wall clock time (CLOCK_MONOTONIC) in nanoseconds
+uint64_t monotonic_ns(void);
+
+/*
+ * print_timer_backends
+ * measures and prints every backend that is available on this machine
+*/
+void print_timer_backends();
+
+#endif
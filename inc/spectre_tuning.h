@@ -0,0 +1,81 @@
+#ifndef SPECTRE_TUNING
+#define SPECTRE_TUNING
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "spectre_attacker.h"
+
+/*
+ * The attack parameters the autotuner searches over.
+*/
+typedef struct
+{
+    // in-bounds training calls before every attack call (ProbeConfig.num_training)
+    size_t num_training;
+    // eviction passes between training and the attack call (ProbeConfig.evict_repeats)
+    size_t evict_repeats;
+    // added to the calibrated hit threshold, in timer ticks (may be negative)
+    int64_t threshold_padding;
+} TuningConfig;
+
+/*
+ * How the autotuner searches.
+*/
+typedef struct
+{
+    // configurations sampled from the search space, including the part's defaults
+    size_t num_candidates;
+    // bytes every configuration leaks in the first round, doubled every round
+    size_t initial_bytes;
+    // the secret the victim holds (NULL: the stock module's)
+    const char* secret;
+} AutotuneConfig;
+
+#define AUTOTUNE_DEFAULT_CANDIDATES 32
+#define AUTOTUNE_DEFAULT_BYTES 4
+// Sweeps per byte while tuning, so hopeless configurations can't stall a round
+#define AUTOTUNE_MAX_SWEEPS 1000
+
+/*
+ * load_tuning
+ * reads the configuration saved by run_autotune for this part, victim, machine
+ * and timer. Returns false if there is none (or it was tuned somewhere else).
+*/
+bool load_tuning(const AttackerPart* part, TuningConfig* tuning);
+bool save_tuning(const AttackerPart* part, const TuningConfig* tuning, double bytes_per_second);
+
+/*
+ * tuned_threshold
+ * the calibrated threshold plus the tuned padding, never below one tick
+*/
+uint64_t tuned_threshold(const CacheStats* stats, const TuningConfig* tuning);
+
+/*
+ * recalibrate_after_byte
+ * Counts one leaked byte in *bytes_since_calibration. Every RECALIBRATION_INTERVAL
+ * bytes it refreshes stats and sets decision->threshold to the tuned threshold, so
+ * the attacker and the benchmarks follow frequency and temperature drift alike.
+*/
+void recalibrate_after_byte(size_t* bytes_since_calibration, CacheStats* stats, const TuningConfig* tuning,
+                            DecisionConfig* decision);
+
+/*
+ * setup_tuned_part
+ * part->setup, then the saved tuning (if any) applied on top. tuning is filled in
+ * with the configuration in use either way.
+*/
+void setup_tuned_part(const AttackerPart* part, int kernel_fd, char* shared_memory, const CacheStats* cache_stats,
+                      ProbeConfig* probe, DecisionConfig* decision, TuningConfig* tuning);
+
+/*
+ * run_autotune
+ * Searches training count, eviction passes and threshold padding with successive
+ * halving: every round leaks the known secret with each surviving configuration,
+ * keeps the better half by correctly leaked bytes per second, and doubles the
+ * bytes for the next round. The winner is saved with save_tuning.
+ *
+ * Returns: EXIT_SUCCESS, or EXIT_FAILURE if the winner couldn't be saved
+*/
+int run_autotune(const AttackerPart* part, int kernel_fd, char* shared_memory, const AutotuneConfig* config);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef SPECTRE_VICTIM
+#define SPECTRE_VICTIM
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "labspectreipc.h"
+
+/*
+ * Where spectre_lab_commands are run.
+*/
+typedef enum
+{
+    // labspectrekm through /proc/SHD_PROCFS_NAME
+    VICTIM_KERNEL,
+    // user space copy of the module's gadgets on a victim thread, reached through a socketpair
+    VICTIM_THREAD,
+    // user space copy of the module's gadgets, called directly from the write path
+    VICTIM_DIRECT,
+} VictimMode;
+
+// Largest fd open_victim can hand out for the user space victims
+#define VICTIM_MAX_FDS 1024
+
+// Module parameter that turns on the kernel victim's oracle
+#define VICTIM_ORACLE_PARAM "/sys/module/labspectrekm/parameters/oracle_mode"
+
+// The kernel victim's secret store (see SHD_PROCFS_SECRET_NAME)
+#define VICTIM_STORE_PROCFS "/proc/" SHD_PROCFS_SECRET_NAME
+
+// Filled in from the command line by main
+extern VictimMode victim_mode;
+
+/*
+ * parse_victim_mode
+ * parses "kernel", "thread" or "direct"
+*/
+bool parse_victim_mode(const char* name, VictimMode* out);
+
+const char* victim_mode_name(VictimMode mode);
+
+/*
+ * open_victim
+ * Opens a victim of the given kind. The result is used like the procfs file
+ * descriptor: pass it to register_shared_memory/ submit_command_batch and close
+ * it with close_victim.
+ *
+ * Returns a file descriptor, or -1 with errno set.
+*/
+int open_victim(VictimMode mode);
+
+/*
+ * victim_write
+ * Delivers one spectre_lab_command, or a spectre_lab_batch_header followed by
+ * its commands, to the victim behind fd. Returns once every command has run.
+ *
+ * Returns the number of bytes accepted, like write().
+*/
+ssize_t victim_write(int fd, const void* buf, size_t len);
+
+/*
+ * enable_victim_oracle
+ * Starts logging the probe line every command on fd targets. User space victims
+ * always support this. The kernel victim only does if labspectrekm was loaded with
+ * oracle_mode=1.
+ *
+ * Returns whether read_victim_oracle will return records for fd.
+*/
+bool enable_victim_oracle(int fd);
+
+/*
+ * read_victim_oracle
+ * Reads up to max_records oracle records logged since the last call, oldest first.
+ * Returns how many were read.
+*/
+size_t read_victim_oracle(int fd, spectre_lab_oracle_record* records, size_t max_records);
+
+/*
+ * configure_secret_store
+ * Fills the secret store of every victim of the given kind with size bytes generated
+ * from seed (shd_spectre_lab_store_byte), for commands with SHD_SPECTRE_LAB_FLAG_STORE.
+ * Replacing the kernel victim's store needs root. Don't call it while leaking.
+ *
+ * Returns whether the store now holds exactly that.
+*/
+bool configure_secret_store(VictimMode mode, size_t size, uint64_t seed);
+
+/*
+ * close_victim
+ * Closes fd. User space victims release their registered region and the victim
+ * thread exits.
+*/
+void close_victim(int fd);
+
+#endif
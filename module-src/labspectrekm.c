@@ -13,6 +13,7 @@
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Joseph Ravichandran <jravi@csail.mit.edu>");
 MODULE_DESCRIPTION("Spectre lab target module for Secure Hardware Design at MIT");
+MODULE_VERSION("2023.2");
 
 // The secrets you're trying to leak!
 static volatile char __attribute__((aligned(32768))) kernel_secret3[SHD_SPECTRE_LAB_SECRET_MAX_LEN] = "MIT{h4rd3st}";
@@ -23,17 +24,166 @@ static volatile char __attribute__((aligned(32768))) kernel_secret1[SHD_SPECTRE_
 static volatile size_t __attribute__((aligned(32768))) secret_leak_limit_part2 = 4;
 static volatile size_t __attribute__((aligned(32768))) secret_leak_limit_part3 = 4;
 
+// Events programmed into PMEVTYPER0-3_EL0 on every core. -1 leaves a counter untouched.
+// These counters are shared with perf, so don't run perf on the event counters at the same time.
+static int pmu_events[SHD_SPECTRE_LAB_PMU_EVENT_COUNTERS] = {
+    SHD_PMU_EVENT_L1D_CACHE_REFILL,
+    SHD_PMU_EVENT_L2D_CACHE_REFILL,
+    SHD_PMU_EVENT_BR_MIS_PRED,
+    SHD_PMU_EVENT_L1D_TLB_REFILL,
+};
+static int pmu_events_count = SHD_SPECTRE_LAB_PMU_EVENT_COUNTERS;
+module_param_array(pmu_events, int, &pmu_events_count, 0444);
+MODULE_PARM_DESC(pmu_events, "PMU event numbers for PMEVCNTR0-3_EL0, readable from EL0 (-1 = unused)");
+
+// Log the probe line each command targets, readable with read() on the victim file
+static bool oracle_mode = false;
+module_param(oracle_mode, bool, 0644);
+MODULE_PARM_DESC(oracle_mode, "Log the probe line every command targets (ground truth for benchmarks)");
+
+// Secret store: seeded pseudo-random bytes that commands with SHD_SPECTRE_LAB_FLAG_STORE
+// read instead of the fixed secrets. Sized at load time by these parameters or later by
+// writing SHD_PROCFS_SECRET_NAME, after which the parameters show the current store.
+static unsigned long secret_store_size = 0;
+module_param(secret_store_size, ulong, 0444);
+MODULE_PARM_DESC(secret_store_size, "Bytes of seeded pseudo-random secret to allocate at load time (0 = none)");
+
+static unsigned long long secret_store_seed = 0;
+module_param(secret_store_seed, ullong, 0444);
+MODULE_PARM_DESC(secret_store_seed, "Seed the secret store is generated from");
+
+// Held for reading while commands run, for writing while the store is replaced
+static DECLARE_RWSEM(secret_store_lock);
+static volatile char *secret_store = NULL;
+
 static struct proc_dir_entry *spectre_lab_procfs_victim = NULL;
 static const struct proc_ops spectre_lab_victim_ops = {
+    .proc_open = spectre_lab_victim_open,
+    .proc_release = spectre_lab_victim_release,
     .proc_write = spectre_lab_victim_write,
     .proc_read = spectre_lab_victim_read,
 };
 
+static struct proc_dir_entry *spectre_lab_procfs_cache = NULL;
+static const struct proc_ops spectre_lab_cache_ops = {
+    .proc_open = spectre_lab_cache_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
+static struct proc_dir_entry *spectre_lab_procfs_secret = NULL;
+static const struct proc_ops spectre_lab_secret_ops = {
+    .proc_open = spectre_lab_secret_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+    .proc_write = spectre_lab_secret_write,
+};
+
+static struct proc_dir_entry *spectre_lab_procfs_stats = NULL;
+static const struct proc_ops spectre_lab_stats_ops = {
+    .proc_open = spectre_lab_stats_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+    .proc_write = spectre_lab_stats_write,
+};
+
 
 typedef struct {
     size_t sets, associativity, line_size;
 } CacheSize;
 
+/*
+ * spectre_lab_cpu_caches
+ * Cache geometry of one core, read on that core when the module loads
+ */
+typedef struct {
+    uint64_t clidr;
+    CacheSize data[SHD_SPECTRE_LAB_MAX_CACHE_LEVELS];
+    CacheSize instruction[SHD_SPECTRE_LAB_MAX_CACHE_LEVELS];
+} spectre_lab_cpu_caches;
+
+static DEFINE_PER_CPU(spectre_lab_cpu_caches, spectre_lab_cache_info);
+
+/*
+ * spectre_lab_session
+ * Per open file state. Holds the pinned and kernel mapped shared memory region,
+ * either for the duration of one write or until the file is closed if the user
+ * registered it with COMMAND_REGISTER_SHARED_MEMORY.
+ */
+typedef struct {
+    // Serializes writes from processes/ threads sharing this open file
+    struct mutex lock;
+
+    // User address of the currently mapped region (0 if nothing is mapped)
+    uint64_t mapped_region;
+
+    // Whether mapped_region should stay mapped across writes
+    bool registered;
+
+    // Number of pages of mapped_region that are pinned and mapped
+    int num_pages;
+
+    struct page *pages[SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES];
+    char *kernel_mapped_region[SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES];
+
+    // Oracle ring buffer (allocated on the first command logged in oracle mode).
+    // oracle_head is the sequence number of the next record, oracle_tail of the next one to read.
+    spectre_lab_oracle_record *oracle;
+    uint64_t oracle_head;
+    uint64_t oracle_tail;
+} spectre_lab_session;
+
+/*
+ * spectre_lab_phase
+ * Parts of spectre_lab_victim_write that are timed separately
+ */
+typedef enum {
+    // copy_from_user of the batch header and every command
+    PHASE_COPY,
+    // get_user_pages_fast of the shared memory region
+    PHASE_PIN,
+    // kmap of every pinned page
+    PHASE_MAP,
+    // spectre_lab_run_command
+    PHASE_GADGET,
+    // kunmap and put_page of the region
+    PHASE_UNMAP,
+    NUM_PHASES
+} spectre_lab_phase;
+
+static const char *const spectre_lab_phase_names[NUM_PHASES] = {
+    "copy", "pin", "map", "gadget", "unmap",
+};
+
+// Histogram bucket i counts latencies in [2^i, 2^(i+1)) ns
+#define SHD_STATS_BUCKETS 32
+
+// Command kinds counted separately. Unknown kinds are counted in the last slot.
+#define SHD_STATS_KINDS (COMMAND_UNREGISTER_SHARED_MEMORY + 1)
+
+static const char *const spectre_lab_kind_names[SHD_STATS_KINDS + 1] = {
+    "part1", "part2", "part3", "register", "unregister", "invalid",
+};
+
+/*
+ * spectre_lab_stats
+ * Per CPU counters for the victim handler. Each CPU only updates its own copy
+ * with this_cpu ops, so recording needs no locks. Readers sum every CPU.
+ */
+typedef struct {
+    uint64_t count[NUM_PHASES];
+    uint64_t total_ns[NUM_PHASES];
+    uint64_t max_ns[NUM_PHASES];
+    uint64_t histogram[NUM_PHASES][SHD_STATS_BUCKETS];
+    uint64_t commands[SHD_STATS_KINDS + 1];
+    uint64_t writes;
+} spectre_lab_stats;
+
+static DEFINE_PER_CPU(spectre_lab_stats, spectre_lab_cpu_stats);
+
 
 void flush(void* addr)
 {
@@ -45,6 +195,7 @@ void enable_pm(void)
     uint64_t control_register;
     uint64_t count_enable;
     uint64_t user_enable;
+    int i;
 
     // PM Control Register
     asm volatile("mrs %0, PMCR_EL0":"=r"(control_register));
@@ -56,14 +207,26 @@ void enable_pm(void)
     asm volatile("mrs %0, PMCNTENSET_EL0":"=r"(count_enable));
     // bit 31: Reads to pmccntr_el0 are enabled
     count_enable |= 0x80000000;
+
+    // Event counters: select counter i with PMSELR_EL0, then set its event type
+    for (i = 0; i < pmu_events_count && i < SHD_SPECTRE_LAB_PMU_EVENT_COUNTERS; i++) {
+        if (pmu_events[i] < 0) continue;
+        asm volatile("msr PMSELR_EL0, %0"::"r"((uint64_t)i));
+        asm volatile("isb");
+        // Filter bits left at 0: count at EL0 and EL1, so the victim's events show up too
+        asm volatile("msr PMXEVTYPER_EL0, %0"::"r"((uint64_t)pmu_events[i] & 0xFFFF));
+        // bit i: PMEVCNTR<i>_EL0 is enabled
+        count_enable |= 1UL << i;
+    }
     asm volatile("msr PMCNTENSET_EL0, %0"::"r"(count_enable));
 
     // PM User Enable Read Register
     asm volatile("mrs %0, PMUSERENR_EL0":"=r"(user_enable));
     // bit 0: Enables EL0 read/write access to PMU registers.
     // bit 2: Cycle counter Read enable.
+    // bit 3: Event counter Read enable.
     printk("Before Setting PMUSERENR_EL0:%#08x\n", user_enable);
-    user_enable |= 0b0101;
+    user_enable |= 0b1101;
     asm volatile("msr PMUSERENR_EL0, %0"::"r"(user_enable));
     asm volatile("mrs %0, PMUSERENR_EL0":"=r"(user_enable));
     printk("After Setting PMUSERENR_EL0:%#08x\n", user_enable);
@@ -81,35 +244,21 @@ void enable_user_cache_maintenance(void)
 
 static struct completion my_thread_completion;
 
-int enable_control_thread_wrapper(void*)
-{
-    enable_user_cache_maintenance();
-    enable_pm(); 
-    complete(&my_thread_completion);
-    return 0;
-}
-
-void enable_control_on_core(int core)
-{
-    init_completion(&my_thread_completion);
-    struct task_struct* task = kthread_create_on_cpu(enable_control_thread_wrapper, &core, core, "enable_control_thread");
-    wake_up_process(task);
-    wait_for_completion(&my_thread_completion);
-}
-
 static int select_cache(size_t cache_level, int is_data_cache)
 {
     uint64_t cache_selection = 0;
     if (cache_level > 7) return 1;
     cache_selection |= ((uint64_t)cache_level << 1) | (uint64_t)(!is_data_cache);
     asm volatile("msr CSSELR_EL1, %0"::"r"(cache_selection));
+    // CCSIDR_EL1 only reflects the new selection after a context synchronization
+    asm volatile("isb");
     return 0;
 }
 
-CacheSize get_cache_info(size_t cache_level)
+CacheSize get_cache_info(size_t cache_level, int is_data_cache)
 {
     uint64_t cache_size;
-    if (select_cache(cache_level, 1) != 0)
+    if (select_cache(cache_level, is_data_cache) != 0)
     {
         return (CacheSize){0,0,0};
     }
@@ -124,6 +273,47 @@ CacheSize get_cache_info(size_t cache_level)
     };
 }
 
+/*
+ * record_cache_info
+ * Decodes every cache level of the core this runs on into spectre_lab_cache_info
+ */
+static void record_cache_info(void)
+{
+    spectre_lab_cpu_caches *info = this_cpu_ptr(&spectre_lab_cache_info);
+    uint64_t cache_type;
+    int level;
+
+    asm volatile("mrs %0, CLIDR_EL1" : "=r"(info->clidr));
+    for (level = 0; level < SHD_SPECTRE_LAB_MAX_CACHE_LEVELS; level++) {
+        cache_type = (info->clidr >> (3 * level)) & 0x7;
+        // 1: instruction only, 3: separate instruction and data
+        if (cache_type == 1 || cache_type == 3) {
+            info->instruction[level] = get_cache_info(level, 0);
+        }
+        // 2: data only, 3: separate, 4: unified
+        if (cache_type >= 2 && cache_type <= 4) {
+            info->data[level] = get_cache_info(level, 1);
+        }
+    }
+}
+
+int enable_control_thread_wrapper(void *data)
+{
+    enable_user_cache_maintenance();
+    enable_pm(); 
+    record_cache_info();
+    complete(&my_thread_completion);
+    return 0;
+}
+
+void enable_control_on_core(int core)
+{
+    init_completion(&my_thread_completion);
+    struct task_struct* task = kthread_create_on_cpu(enable_control_thread_wrapper, &core, core, "enable_control_thread");
+    wake_up_process(task);
+    wait_for_completion(&my_thread_completion);
+}
+
 void print_cache_info(void)
 {
     uint32_t cache_level_id, cache_id;
@@ -149,7 +339,7 @@ void print_cache_info(void)
         }
         if (cache_id >= 2 && cache_id <= 4)
         {
-            CacheSize size = get_cache_info(i);
+            CacheSize size = get_cache_info(i, 1);
             printk("Line Size: %ld\nSets: %lu\nAssociativity:%ld\nSize:%lu bytes",
                 size.line_size, size.sets, size.associativity, size.line_size * size.sets * size.associativity
             );
@@ -165,6 +355,36 @@ void print_cache_info(void)
     printk(SHD_PRINT_INFO "Level of Unification Uniprocessor: %d\n", cache_level_id & 0x7);
 }
 
+/*
+ * spectre_lab_record
+ * Adds one sample of phase, which started at start_ns (ktime_get_ns), to this CPU's stats
+ */
+static void spectre_lab_record(spectre_lab_phase phase, uint64_t start_ns)
+{
+    uint64_t ns = ktime_get_ns() - start_ns;
+    int bucket = ns ? ilog2(ns) : 0;
+
+    if (bucket >= SHD_STATS_BUCKETS) bucket = SHD_STATS_BUCKETS - 1;
+
+    this_cpu_inc(spectre_lab_cpu_stats.count[phase]);
+    this_cpu_add(spectre_lab_cpu_stats.total_ns[phase], ns);
+    this_cpu_inc(spectre_lab_cpu_stats.histogram[phase][bucket]);
+    // Racy against preemption, but only ever loses a maximum
+    if (ns > this_cpu_read(spectre_lab_cpu_stats.max_ns[phase])) {
+        this_cpu_write(spectre_lab_cpu_stats.max_ns[phase], ns);
+    }
+}
+
+/*
+ * spectre_lab_count_command
+ * Counts one command of the given kind on this CPU
+ */
+static void spectre_lab_count_command(spectre_lab_command_kind kind)
+{
+    unsigned int slot = (unsigned int)kind < SHD_STATS_KINDS ? (unsigned int)kind : SHD_STATS_KINDS;
+    this_cpu_inc(spectre_lab_cpu_stats.commands[slot]);
+}
+
 /*
  * print_cmd
  * Prints a nicely formatted command to stdout
@@ -184,6 +404,45 @@ void print_cmd(spectre_lab_command *cmd) {
             cmd->arg1);
 }
 
+/*
+ * spectre_lab_fill_store
+ * Replaces the secret store with size bytes generated from seed.
+ *
+ * Arguments:
+ *  - size: Bytes to allocate (0 frees the store, at most SHD_SPECTRE_LAB_STORE_MAX_SIZE)
+ *  - seed: Seed for shd_spectre_lab_store_byte
+ *
+ * Returns: 0 on success, -EINVAL or -ENOMEM (in which case the old store is kept)
+ */
+static int spectre_lab_fill_store(unsigned long size, uint64_t seed)
+{
+    char *store = NULL;
+    volatile char *old_store;
+    unsigned long i;
+
+    if (size > SHD_SPECTRE_LAB_STORE_MAX_SIZE) return -EINVAL;
+
+    if (size > 0) {
+        store = vmalloc(size);
+        if (NULL == store) return -ENOMEM;
+        for (i = 0; i < size; i++) {
+            store[i] = shd_spectre_lab_store_byte(seed, i);
+            if ((i & 0xFFFFF) == 0xFFFFF) cond_resched();
+        }
+    }
+
+    down_write(&secret_store_lock);
+    old_store = secret_store;
+    secret_store = store;
+    secret_store_size = size;
+    secret_store_seed = seed;
+    up_write(&secret_store_lock);
+
+    vfree((void *)old_store);
+    printk(SHD_PRINT_INFO "Secret store: %lu bytes from seed %llu\n", size, (unsigned long long)seed);
+    return 0;
+}
+
 /*
  * spectre_lab_init
  * Installs the procfs handlers for communicating with this module.
@@ -197,7 +456,14 @@ int spectre_lab_init(void) {
     printk(SHD_PRINT_INFO "On Core: %d\n", cpu);
     put_cpu();
     print_cache_info();
+    if (secret_store_size > 0 && spectre_lab_fill_store(secret_store_size, secret_store_seed) != 0) {
+        printk(SHD_PRINT_INFO "Unable to allocate a %lu byte secret store\n", secret_store_size);
+        secret_store_size = 0;
+    }
     spectre_lab_procfs_victim = proc_create(SHD_PROCFS_NAME, 0, NULL, &spectre_lab_victim_ops);
+    spectre_lab_procfs_stats = proc_create(SHD_PROCFS_STATS_NAME, 0644, NULL, &spectre_lab_stats_ops);
+    spectre_lab_procfs_cache = proc_create(SHD_PROCFS_CACHE_NAME, 0, NULL, &spectre_lab_cache_ops);
+    spectre_lab_procfs_secret = proc_create(SHD_PROCFS_SECRET_NAME, 0644, NULL, &spectre_lab_secret_ops);
     return 0;
 }
 
@@ -208,143 +474,581 @@ int spectre_lab_init(void) {
 void spectre_lab_fini(void) {
     printk(SHD_PRINT_INFO "SHD Spectre KM Unloaded\n");
     proc_remove(spectre_lab_procfs_victim);
+    proc_remove(spectre_lab_procfs_stats);
+    proc_remove(spectre_lab_procfs_cache);
+    proc_remove(spectre_lab_procfs_secret);
+    spectre_lab_fill_store(0, 0);
+}
+
+/*
+ * spectre_lab_map_region
+ * Pins the first num_pages pages of the user's shared memory region and maps them into the kernel.
+ *
+ * Arguments:
+ *  - session: The session to store the pinned pages and their kernel aliases in
+ *  - user_region: User virtual address of the shared memory region
+ *  - num_pages: Pages to pin (1 to SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES)
+ *
+ * Returns: 0 on success, -1 on failure (in which case nothing is left pinned)
+ */
+static int spectre_lab_map_region(spectre_lab_session *session, uint64_t user_region, int num_pages)
+{
+    int retval;
+    int i, j;
+    uint64_t start_ns;
+
+    if (num_pages < 1 || num_pages > SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES) {
+        printk(SHD_PRINT_INFO "Invalid user request- can't pin %d pages\n", num_pages);
+        return -1;
+    }
+
+    if (!access_ok(user_region, (size_t)num_pages * SHD_SPECTRE_LAB_PAGE_SIZE)) {
+        printk(SHD_PRINT_INFO "Invalid user request- shared memory is 0x%llX\n", user_region);
+        return -1;
+    }
+
+    // Pin the pages to RAM so they aren't swapped to disk
+    start_ns = ktime_get_ns();
+    retval = get_user_pages_fast(user_region, num_pages, FOLL_WRITE, session->pages);
+    spectre_lab_record(PHASE_PIN, start_ns);
+    if (num_pages != retval) {
+        printk(SHD_PRINT_INFO "Unable to pin the user pages! Requested %d pages, got %d\n", num_pages, retval);
+
+        // If the return value is negative, its an error, so don't try to unpin!
+        if (retval > 0) {
+            // Unpin the pages that got pinned before exiting
+            for (i = 0; i < retval; i++) {
+                put_page(session->pages[i]);
+            }
+        }
+
+        return -1;
+    }
+
+    // Map the new pages (aliases to the userspace pages) into the kernel address space
+    // Accessing these pages will incur a TLB miss as they were just remapped
+    start_ns = ktime_get_ns();
+    for (i = 0; i < num_pages; i++) {
+        session->kernel_mapped_region[i] = (char *)kmap(session->pages[i]);
+
+        if (NULL == session->kernel_mapped_region[i]) {
+            printk(SHD_PRINT_INFO "Unable to map page %d\n", i);
+
+            // Unmap everything in reverse order and return early
+            for (j = i - 1; j >= 0; j--) {
+                kunmap(session->pages[j]);
+            }
+            for (j = 0; j < num_pages; j++) {
+                put_page(session->pages[j]);
+            }
+
+            return -1;
+        }
+    }
+
+    spectre_lab_record(PHASE_MAP, start_ns);
+
+    session->mapped_region = user_region;
+    session->num_pages = num_pages;
+    return 0;
+}
+
+/*
+ * spectre_lab_unmap_region
+ * Undoes spectre_lab_map_region. Does nothing if no region is mapped.
+ *
+ * Arguments:
+ *  - session: The session whose region should be released
+ *
+ * Returns: None
+ */
+static void spectre_lab_unmap_region(spectre_lab_session *session)
+{
+    int i;
+    uint64_t start_ns;
+
+    if (0 == session->mapped_region) return;
+
+    start_ns = ktime_get_ns();
+
+    // Unmap in reverse order- needs to be reverse order!
+    for (i = session->num_pages - 1; i >= 0; i--) {
+        kunmap(session->pages[i]);
+    }
+
+    // Unpin to ensure refcounts are valid
+    for (i = 0; i < session->num_pages; i++) {
+        put_page(session->pages[i]);
+    }
+    spectre_lab_record(PHASE_UNMAP, start_ns);
+
+    session->mapped_region = 0;
+    session->num_pages = 0;
+    session->registered = false;
+}
+
+/*
+ * spectre_lab_victim_open
+ * procfs open handler. Every open file gets its own session, so concurrent
+ * attacker processes never share (or unmap) each other's regions.
+ */
+int spectre_lab_victim_open(struct inode *inode, struct file *file_in) {
+    spectre_lab_session *session = kzalloc(sizeof(*session), GFP_KERNEL);
+    if (NULL == session) return -ENOMEM;
+
+    mutex_init(&session->lock);
+    file_in->private_data = session;
+    return 0;
+}
+
+/*
+ * spectre_lab_victim_release
+ * procfs release handler. Unpins the registered region (if any) and frees the session.
+ */
+int spectre_lab_victim_release(struct inode *inode, struct file *file_in) {
+    spectre_lab_session *session = file_in->private_data;
+
+    if (NULL != session) {
+        spectre_lab_unmap_region(session);
+        kvfree(session->oracle);
+        mutex_destroy(&session->lock);
+        kfree(session);
+        file_in->private_data = NULL;
+    }
+    return 0;
 }
 
 /*
  * spectre_lab_victim_read
- * procfs read handler that does nothing so that reading from /proc/SHD_PROCFS_NAME
- * can actually return.
+ * procfs read handler. Returns the oracle records of this open file that haven't been
+ * read yet, as many whole spectre_lab_oracle_record structs as fit. Returns 0 when there
+ * are none (always the case unless oracle_mode is on).
  */
 ssize_t spectre_lab_victim_read(struct file *file_in, char __user *userbuf, size_t num_bytes, loff_t *offset) {
-    // Reading does nothing
-    return 0;
+    spectre_lab_session *session = file_in->private_data;
+    spectre_lab_oracle_record *record;
+    size_t max_records = num_bytes / sizeof(spectre_lab_oracle_record);
+    size_t n = 0;
+
+    mutex_lock(&session->lock);
+    if (NULL != session->oracle) {
+        // Skip whatever was overwritten since the last read
+        if (session->oracle_head - session->oracle_tail > SHD_SPECTRE_LAB_ORACLE_LEN) {
+            session->oracle_tail = session->oracle_head - SHD_SPECTRE_LAB_ORACLE_LEN;
+        }
+
+        while (n < max_records && session->oracle_tail < session->oracle_head) {
+            record = &session->oracle[session->oracle_tail % SHD_SPECTRE_LAB_ORACLE_LEN];
+            if (copy_to_user(userbuf + n * sizeof(*record), record, sizeof(*record)) != 0) break;
+            session->oracle_tail++;
+            n++;
+        }
+    }
+    mutex_unlock(&session->lock);
+
+    return n * sizeof(spectre_lab_oracle_record);
+}
+
+/*
+ * spectre_lab_oracle_log
+ * Appends the ground truth for cmd to the session's oracle ring buffer.
+ * Called with the session lock held.
+ */
+static void spectre_lab_oracle_log(spectre_lab_session *session, spectre_lab_command *cmd, int target, bool architectural)
+{
+    spectre_lab_oracle_record *record;
+
+    if (NULL == session->oracle) {
+        session->oracle = kvcalloc(SHD_SPECTRE_LAB_ORACLE_LEN, sizeof(*session->oracle), GFP_KERNEL);
+        if (NULL == session->oracle) return;
+    }
+
+    record = &session->oracle[session->oracle_head % SHD_SPECTRE_LAB_ORACLE_LEN];
+    record->sequence = session->oracle_head++;
+    record->kind = cmd->kind;
+    record->flags = cmd->flags;
+    record->offset = cmd->arg2;
+    record->target = target;
+    record->architectural = architectural;
+}
+
+/*
+ * spectre_lab_run_command
+ * Runs a single, already validated command against the mapped shared memory region.
+ *
+ * Arguments:
+ *  - cmd: The command to run
+ *  - kernel_mapped_region: Kernel aliases of the mapped pages of the shared memory region,
+ *    at least SHD_SPECTRE_LAB_FIELD_LINES(cmd->flags) of them
+ *  - architectural: Set to whether the access passed the bounds check
+ *  - log_target: Whether the target is needed (oracle mode). Part 3 has to load
+ *    the secret architecturally to find it, so it is only computed when asked for.
+ *
+ * Returns: The probe line the gadget targeted (SHD_SPECTRE_LAB_ORACLE_NO_TARGET if none)
+ * Side Effects: Will trigger a spectre bug based on cmd->kind
+ */
+static int spectre_lab_run_command(spectre_lab_command *cmd, char **kernel_mapped_region, bool *architectural, bool log_target)
+{
+    int i, z;
+    int target = SHD_SPECTRE_LAB_ORACLE_NO_TARGET;
+    bool from_store = cmd->flags & SHD_SPECTRE_LAB_FLAG_STORE;
+    volatile char *secret;
+    unsigned char secret_data;
+    volatile char tmp;
+    size_t long_latency;
+    char *addr_to_leak;
+    unsigned int field_shift, field_mask;
+
+    // Process this command packet
+    switch (cmd->kind) {
+        // Part 1 is Flush+Reload, so access a secret without a bounds check
+        case COMMAND_PART1:
+            secret = from_store ? secret_store : kernel_secret1;
+            secret_data = secret[cmd->arg2];
+            if (secret_data < SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES) {
+                tmp = *kernel_mapped_region[SHD_SPECTRE_LAB_FIELD(secret_data, cmd->flags)];
+                target = SHD_SPECTRE_LAB_FIELD(secret_data, cmd->flags);
+            }
+            *architectural = true;
+        break;
+
+        // Part 2 is Spectre, so access a secret bounded by a bounds check
+        case COMMAND_PART2:
+            // Load the secret:
+            secret = from_store ? secret_store : kernel_secret2;
+            secret_data = secret[cmd->arg2];
+
+            // Trigger a page walk:
+            addr_to_leak = kernel_mapped_region[SHD_SPECTRE_LAB_FIELD(secret_data, cmd->flags)];
+
+            // Flush the limit variable to make this if statement take a long time to resolve
+            flush(&secret_leak_limit_part2);
+            if (cmd->arg2 < secret_leak_limit_part2) {
+                // Perform the speculative leak
+                tmp = *addr_to_leak;
+            }
+            target = SHD_SPECTRE_LAB_FIELD(secret_data, cmd->flags);
+            *architectural = cmd->arg2 < secret_leak_limit_part2;
+        break;
+
+        // Part 3 is a more difficult version of Spectre
+        case COMMAND_PART3:
+            // No cache flush this time around!
+            secret = from_store ? secret_store : kernel_secret3;
+            // Decode the field before the window opens, so only the secret load,
+            // a shift and a mask sit between the bounds check and the probe access
+            field_shift = SHD_SPECTRE_LAB_FIELD_SHIFT(cmd->flags);
+            field_mask = SHD_SPECTRE_LAB_FIELD_LINES(cmd->flags) - 1;
+            for (z = 0; z < 1000; z++);
+            if (cmd->arg2 < secret_leak_limit_part3) {
+                long_latency = cmd->arg2 * 1ULL * 1ULL * 1ULL * 1ULL * 0ULL;
+                tmp = *kernel_mapped_region[((((unsigned char)secret[cmd->arg2]) >> field_shift) & field_mask) + long_latency];
+            }
+            // An architectural load of the secret: it stays cached for every later command,
+            // which part 3 is meant to do without, so only the oracle pays for it
+            if (log_target) {
+                target = SHD_SPECTRE_LAB_FIELD(secret[cmd->arg2], cmd->flags);
+            }
+            *architectural = cmd->arg2 < secret_leak_limit_part3;
+        break;
+
+        // Session management commands are handled by the write handler
+        default:
+            *architectural = false;
+        break;
+    }
+
+    // Training commands must not leave their (architectural) access in the cache.
+    // Only the lines this command's encoding can reach need flushing.
+    if (cmd->flags & SHD_SPECTRE_LAB_FLAG_TRAIN) {
+        for (i = 0; i < SHD_SPECTRE_LAB_FIELD_LINES(cmd->flags); i++) {
+            flush(kernel_mapped_region[i]);
+        }
+        asm volatile("dsb sy");
+    }
+
+    return target;
 }
 
 /*
  * spectre_lab_victim_write
  * procfs write handler for interacting with the module
- * Writes expect the user to write a spectre_lab_command struct to the module.
+ * Writes expect the user to write either a single spectre_lab_command struct,
+ * or a spectre_lab_batch_header followed by header.count spectre_lab_command structs.
  *
- * Input: A spectre_lab_command struct for us to parse.
+ * If the session has a registered region, commands reuse its mapping. Otherwise the
+ * region is pinned and mapped for the duration of this write only (once per batch).
+ *
+ * Input: A spectre_lab_command struct (or a batch of them) for us to parse.
  * Output: Number of bytes accepted by the module.
- * Side Effects: Will trigger a spectre bug based on the user_cmd.kind
+ * Side Effects: Will trigger a spectre bug based on the user_cmd.kind of each command
  */
 ssize_t spectre_lab_victim_write(struct file *file_in, const char __user *userbuf, size_t num_bytes, loff_t *offset)
 {
+    spectre_lab_session *session = file_in->private_data;
+    spectre_lab_batch_header header;
     spectre_lab_command user_cmd;
-    struct page *pages[SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES];
-    char *kernel_mapped_region[SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES];
-    int retval;
-    int i, j, z;
-    char secret_data;
-    volatile char tmp;
-    size_t long_latency;
-    char *addr_to_leak;
+    const char __user *next_cmd = userbuf;
+    size_t num_cmds = 1;
+    ssize_t retval = num_bytes;
+    size_t n;
+    bool have_header, architectural, log_target;
+    uint64_t start_ns, secret_len;
+    int target, num_pages;
 
-    for (i = 0; i < SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES; i++) {
-        pages[i] = NULL;
-    }
+    this_cpu_inc(spectre_lab_cpu_stats.writes);
 
-    if (copy_from_user(&user_cmd, userbuf, sizeof(user_cmd)) == 0) {
-        // arg1 is always a pointer to the shared memory region
-        if (!access_ok(user_cmd.arg1, SHD_SPECTRE_LAB_SHARED_MEMORY_SIZE)) {
-            printk(SHD_PRINT_INFO "Invalid user request- shared memory is 0x%llX\n", user_cmd.arg1);
+    // Is this a batch of commands?
+    start_ns = ktime_get_ns();
+    have_header = num_bytes >= sizeof(header) && copy_from_user(&header, userbuf, sizeof(header)) == 0;
+
+    if (have_header && SHD_SPECTRE_LAB_BATCH_MAGIC == header.magic) {
+        // Only a real header is a copy of its own. A single command's bytes are
+        // copied (and recorded) again below, so that probe isn't counted.
+        spectre_lab_record(PHASE_COPY, start_ns);
+        if (header.count == 0 || header.count > SHD_SPECTRE_LAB_MAX_BATCH_LEN ||
+                num_bytes < sizeof(header) + header.count * sizeof(user_cmd)) {
+            printk(SHD_PRINT_INFO "Invalid batch of %u commands (%zu bytes)\n", header.count, num_bytes);
             return num_bytes;
         }
+        num_cmds = header.count;
+        next_cmd += sizeof(header);
+    }
 
-        // arg2 is always the secret index to use
-        if (!(user_cmd.arg2 < SHD_SPECTRE_LAB_SECRET_MAX_LEN)) {
-            printk(SHD_PRINT_INFO "Tried to access a secret that is too large! Requested offset %llu\n", user_cmd.arg2);
-            return num_bytes;
+    mutex_lock(&session->lock);
+    down_read(&secret_store_lock);
+
+    // Run every command back-to-back while the region is mapped
+    for (n = 0; n < num_cmds; n++) {
+        start_ns = ktime_get_ns();
+        if (copy_from_user(&user_cmd, next_cmd + n * sizeof(user_cmd), sizeof(user_cmd)) != 0) {
+            // Error
+            if (0 == n) retval = 0;
+            break;
         }
+        spectre_lab_record(PHASE_COPY, start_ns);
+        spectre_lab_count_command(user_cmd.kind);
 
-        // Pin the pages to RAM so they aren't swapped to disk
-        retval = get_user_pages_fast(user_cmd.arg1, SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES, FOLL_WRITE, pages);
-        if (SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES != retval) {
-            printk(SHD_PRINT_INFO "Unable to pin the user pages! Requested %d pages, got %d\n", SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES, retval);
-
-            // If the return value is negative, its an error, so don't try to unpin!
-            if (retval > 0) {
-                // Unpin the pages that got pinned before exiting
-                for (i = 0; i < retval; i++) {
-                    put_page(pages[i]);
-                }
+        if (COMMAND_REGISTER_SHARED_MEMORY == user_cmd.kind) {
+            // arg2 is the number of pages to pin, 0 for all of them
+            num_pages = SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES;
+            if (0 != user_cmd.arg2) {
+                num_pages = user_cmd.arg2 > SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES ? -1 : (int)user_cmd.arg2;
+            }
+            spectre_lab_unmap_region(session);
+            if (spectre_lab_map_region(session, user_cmd.arg1, num_pages) == 0) {
+                session->registered = true;
             }
+            continue;
+        }
 
-            return num_bytes;
+        if (COMMAND_UNREGISTER_SHARED_MEMORY == user_cmd.kind) {
+            spectre_lab_unmap_region(session);
+            continue;
         }
 
-        // Map the new pages (aliases to the userspace pages) into the kernel address space
-        // Accessing these pages will incur a TLB miss as they were just remapped
-        for (i = 0; i < SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES; i++) {
-            kernel_mapped_region[i] = (char *)kmap(pages[i]);
+        // arg1 is always a pointer to the shared memory region
+        if (0 == session->mapped_region) {
+            if (spectre_lab_map_region(session, user_cmd.arg1, SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES) != 0) {
+                break;
+            }
+        }
+        else if (user_cmd.arg1 != session->mapped_region) {
+            printk(SHD_PRINT_INFO "Command %zu uses a different shared memory region (0x%llX) than the mapped one (0x%llX)\n",
+                    n, user_cmd.arg1, session->mapped_region);
+            break;
+        }
 
-            if (NULL == kernel_mapped_region[i]) {
-                printk(SHD_PRINT_INFO "Unable to map page %d\n", i);
+        // arg2 is always the secret index to use (into the secret store if the command asks for it)
+        secret_len = (user_cmd.flags & SHD_SPECTRE_LAB_FLAG_STORE) ? secret_store_size : SHD_SPECTRE_LAB_SECRET_MAX_LEN;
+        if (!(user_cmd.arg2 < secret_len)) {
+            printk(SHD_PRINT_INFO "Tried to access a secret that is too large! Requested offset %llu\n", user_cmd.arg2);
+            break;
+        }
 
-                // Unmap everything in reverse order and return early
-                for (j = i - 1; j >= 0; j--) {
-                    kunmap(pages[j]);
-                }
+        // The encoding must be one we support, and only reach pages that are mapped
+        if (!SHD_SPECTRE_LAB_FIELD_VALID(user_cmd.flags) ||
+                SHD_SPECTRE_LAB_FIELD_LINES(user_cmd.flags) > session->num_pages) {
+            printk(SHD_PRINT_INFO "Invalid bit-field (flags 0x%X) for %d mapped pages\n", user_cmd.flags, session->num_pages);
+            break;
+        }
 
-                return num_bytes;
-            }
+        // Read once, root may flip oracle_mode while we run
+        log_target = oracle_mode;
+        start_ns = ktime_get_ns();
+        target = spectre_lab_run_command(&user_cmd, session->kernel_mapped_region, &architectural, log_target);
+        spectre_lab_record(PHASE_GADGET, start_ns);
+
+        if (log_target) {
+            spectre_lab_oracle_log(session, &user_cmd, target, architectural);
         }
+    }
 
-        // Process this command packet
-        switch (user_cmd.kind) {
-            // Part 1 is Flush+Reload, so access a secret without a bounds check
-            case COMMAND_PART1:
-                secret_data = kernel_secret1[user_cmd.arg2];
-                if (secret_data < SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES) {
-                    tmp = *kernel_mapped_region[secret_data];
-                }
-            break;
+    // Regions that weren't registered only live for the duration of a single write
+    if (!session->registered) {
+        spectre_lab_unmap_region(session);
+    }
 
-            // Part 2 is Spectre, so access a secret bounded by a bounds check
-            case COMMAND_PART2:
-                // Load the secret:
-                secret_data = kernel_secret2[user_cmd.arg2];
+    up_read(&secret_store_lock);
+    mutex_unlock(&session->lock);
 
-                // Trigger a page walk:
-                addr_to_leak = kernel_mapped_region[secret_data];
+    // Success!
+    return retval;
+}
 
-                // Flush the limit variable to make this if statement take a long time to resolve
-                flush(&secret_leak_limit_part2);
-                if (user_cmd.arg2 < secret_leak_limit_part2) {
-                    // Perform the speculative leak
-                    tmp = *addr_to_leak;
-                }
-            break;
+/*
+ * spectre_lab_stats_show
+ * Prints the victim handler statistics, summed over every CPU.
+ */
+static int spectre_lab_stats_show(struct seq_file *m, void *v)
+{
+    spectre_lab_stats *stats;
+    uint64_t count, total_ns, max_ns, bucket_count;
+    int phase, bucket, kind, cpu;
 
-            // Part 3 is a more difficult version of Spectre
-            case COMMAND_PART3:
-                // No cache flush this time around!
-                for (z = 0; z < 1000; z++);
-                if (user_cmd.arg2 < secret_leak_limit_part3) {
-                    long_latency = user_cmd.arg2 * 1ULL * 1ULL * 1ULL * 1ULL * 0ULL;
-                    tmp = *kernel_mapped_region[kernel_secret3[user_cmd.arg2] + long_latency];
-                }
-            break;
+    seq_printf(m, "# phase count mean_ns max_ns histogram (bucket i counts [2^i, 2^(i+1)) ns)\n");
+    for (phase = 0; phase < NUM_PHASES; phase++) {
+        count = total_ns = max_ns = 0;
+        for_each_possible_cpu(cpu) {
+            stats = per_cpu_ptr(&spectre_lab_cpu_stats, cpu);
+            count += stats->count[phase];
+            total_ns += stats->total_ns[phase];
+            if (stats->max_ns[phase] > max_ns) max_ns = stats->max_ns[phase];
         }
+        seq_printf(m, "%s %llu %llu %llu", spectre_lab_phase_names[phase], count,
+                count ? total_ns / count : 0, max_ns);
 
-        // Unmap in reverse order- needs to be reverse order!
-        for (i = SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES - 1; i >= 0; i--) {
-            kunmap(pages[i]);
+        for (bucket = 0; bucket < SHD_STATS_BUCKETS; bucket++) {
+            bucket_count = 0;
+            for_each_possible_cpu(cpu) {
+                bucket_count += per_cpu_ptr(&spectre_lab_cpu_stats, cpu)->histogram[phase][bucket];
+            }
+            seq_printf(m, " %llu", bucket_count);
         }
+        seq_printf(m, "\n");
+    }
 
-        // Unpin to ensure refcounts are valid
-        for (i = 0; i < SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES; i++) {
-            put_page(pages[i]);
+    seq_printf(m, "# kind commands\n");
+    for (kind = 0; kind <= SHD_STATS_KINDS; kind++) {
+        count = 0;
+        for_each_possible_cpu(cpu) {
+            count += per_cpu_ptr(&spectre_lab_cpu_stats, cpu)->commands[kind];
         }
+        seq_printf(m, "%s %llu\n", spectre_lab_kind_names[kind], count);
+    }
+
+    seq_printf(m, "# cpu writes gadgets\n");
+    for_each_possible_cpu(cpu) {
+        stats = per_cpu_ptr(&spectre_lab_cpu_stats, cpu);
+        seq_printf(m, "cpu%d %llu %llu\n", cpu, stats->writes, stats->count[PHASE_GADGET]);
+    }
+    return 0;
+}
+
+/*
+ * spectre_lab_stats_open
+ * procfs open handler for the statistics file.
+ */
+int spectre_lab_stats_open(struct inode *inode, struct file *file_in) {
+    return single_open(file_in, spectre_lab_stats_show, NULL);
+}
+
+/*
+ * spectre_lab_stats_write
+ * procfs write handler for the statistics file. Any write resets every counter.
+ * Commands running on other CPUs at the same time may survive the reset.
+ */
+ssize_t spectre_lab_stats_write(struct file *file_in, const char __user *userbuf, size_t num_bytes, loff_t *offset) {
+    int cpu;
 
-        // Success!
-        return num_bytes;
+    for_each_possible_cpu(cpu) {
+        memset(per_cpu_ptr(&spectre_lab_cpu_stats, cpu), 0, sizeof(spectre_lab_stats));
     }
-    else {
-        // Error
-        return 0;
+    return num_bytes;
+}
+
+/*
+ * spectre_lab_secret_show
+ * Prints the size and seed of the current secret store.
+ */
+static int spectre_lab_secret_show(struct seq_file *m, void *v)
+{
+    down_read(&secret_store_lock);
+    seq_printf(m, "%lu %llu\n", secret_store_size, secret_store_seed);
+    up_read(&secret_store_lock);
+    return 0;
+}
+
+/*
+ * spectre_lab_secret_open
+ * procfs open handler for the secret store file.
+ */
+int spectre_lab_secret_open(struct inode *inode, struct file *file_in) {
+    return single_open(file_in, spectre_lab_secret_show, NULL);
+}
+
+/*
+ * spectre_lab_secret_write
+ * procfs write handler for the secret store file. Expects "<size> <seed>" and
+ * refills the store once commands using the old one are done.
+ */
+ssize_t spectre_lab_secret_write(struct file *file_in, const char __user *userbuf, size_t num_bytes, loff_t *offset) {
+    char buf[64];
+    unsigned long size;
+    unsigned long long seed;
+    size_t len = min(num_bytes, sizeof(buf) - 1);
+    int retval;
+
+    if (copy_from_user(buf, userbuf, len) != 0) return -EFAULT;
+    buf[len] = '\0';
+    if (sscanf(buf, "%lu %llu", &size, &seed) != 2) return -EINVAL;
+
+    retval = spectre_lab_fill_store(size, seed);
+    return retval != 0 ? retval : num_bytes;
+}
+
+/*
+ * spectre_lab_cache_show
+ * Prints the geometry of every cache of every core, one line per cache.
+ */
+static int spectre_lab_cache_show(struct seq_file *m, void *v)
+{
+    spectre_lab_cpu_caches *info;
+    CacheSize *size;
+    uint64_t cache_type;
+    int cpu, level;
+
+    seq_printf(m, "# cpu level type line_size sets ways size\n");
+    for_each_possible_cpu(cpu) {
+        info = per_cpu_ptr(&spectre_lab_cache_info, cpu);
+        for (level = 0; level < SHD_SPECTRE_LAB_MAX_CACHE_LEVELS; level++) {
+            cache_type = (info->clidr >> (3 * level)) & 0x7;
+            if (cache_type == 0) break;
+
+            if (cache_type == 1 || cache_type == 3) {
+                size = &info->instruction[level];
+                seq_printf(m, "%d %d instruction %zu %zu %zu %zu\n", cpu, level + 1,
+                        size->line_size, size->sets, size->associativity,
+                        size->line_size * size->sets * size->associativity);
+            }
+            if (cache_type >= 2 && cache_type <= 4) {
+                size = &info->data[level];
+                seq_printf(m, "%d %d %s %zu %zu %zu %zu\n", cpu, level + 1,
+                        cache_type == 4 ? "unified" : "data",
+                        size->line_size, size->sets, size->associativity,
+                        size->line_size * size->sets * size->associativity);
+            }
+        }
     }
+    return 0;
+}
+
+/*
+ * spectre_lab_cache_open
+ * procfs open handler for the cache geometry file.
+ */
+int spectre_lab_cache_open(struct inode *inode, struct file *file_in) {
+    return single_open(file_in, spectre_lab_cache_show, NULL);
 }
 
 module_init(spectre_lab_init);
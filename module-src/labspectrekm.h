@@ -9,6 +9,14 @@
 #include <linux/uaccess.h>
 #include <linux/mm.h>
 #include <linux/highmem.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
+#include <linux/rwsem.h>
 
 #define SHD_LABNAME "labspectre"
 #define SHD_PRINT_INFO KERN_INFO "[" SHD_LABNAME "] "
@@ -17,7 +25,17 @@ void flush(void* addr);
 void enable_pm(void);
 void print_cache_info(void);
 
+int spectre_lab_victim_open(struct inode *inode, struct file *file_in);
+int spectre_lab_victim_release(struct inode *inode, struct file *file_in);
 ssize_t spectre_lab_victim_read(struct file *file_in, char __user *userbuf, size_t num_bytes, loff_t *offset);
 ssize_t spectre_lab_victim_write(struct file *file_in, const char __user *userbuf, size_t num_bytes, loff_t *offset);
 
+int spectre_lab_cache_open(struct inode *inode, struct file *file_in);
+
+int spectre_lab_secret_open(struct inode *inode, struct file *file_in);
+ssize_t spectre_lab_secret_write(struct file *file_in, const char __user *userbuf, size_t num_bytes, loff_t *offset);
+
+int spectre_lab_stats_open(struct inode *inode, struct file *file_in);
+ssize_t spectre_lab_stats_write(struct file *file_in, const char __user *userbuf, size_t num_bytes, loff_t *offset);
+
 #endif // SHD_SPECTRE_LAB_KM_H
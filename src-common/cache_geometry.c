@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache_geometry.h"
+#include "eviction_set.h"
+#include "labspectreipc.h"
+
+static CacheGeometry geometry;
+static pthread_once_t geometry_once = PTHREAD_ONCE_INIT;
+
+static CacheLevel make_level(unsigned level, size_t line_size, size_t sets, size_t ways)
+{
+    return (CacheLevel) {
+        .level = level,
+        .line_size = line_size,
+        .sets = sets,
+        .ways = ways,
+        .size = line_size * sets * ways,
+    };
+}
+
+/*
+ * read_module_level
+ * finds the data/ unified cache at level for cpu in the module's cache file
+*/
+static bool read_module_level(int cpu, unsigned level, CacheLevel* out)
+{
+    FILE* f = fopen("/proc/" SHD_PROCFS_CACHE_NAME, "r");
+    char line[128], type[16];
+    int line_cpu;
+    unsigned line_level;
+    size_t line_size, sets, ways, size;
+    bool found = false;
+
+    if (f == NULL) return false;
+    while (!found && fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%d %u %15s %zu %zu %zu %zu", &line_cpu, &line_level, type, &line_size, &sets, &ways, &size) != 7) continue;
+        if (line_cpu != cpu || line_level != level || strcmp(type, "instruction") == 0) continue;
+        *out = make_level(level, line_size, sets, ways);
+        found = true;
+    }
+    fclose(f);
+    return found;
+}
+
+static bool read_sysfs_value(int cpu, int index, const char* name, char* buf, size_t len)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/%s", cpu, index, name);
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return false;
+    bool ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return ok;
+}
+
+/*
+ * read_sysfs_level
+ * same as read_module_level, from /sys/devices/system/cpu/cpu<N>/cache/index<i>
+*/
+static bool read_sysfs_level(int cpu, unsigned level, CacheLevel* out)
+{
+    char buf[32];
+    for (int index = 0; read_sysfs_value(cpu, index, "level", buf, sizeof(buf)); index++) {
+        size_t line_size, sets, ways;
+        if (strtoul(buf, NULL, 10) != level) continue;
+        if (!read_sysfs_value(cpu, index, "type", buf, sizeof(buf)) || strcmp(buf, "Instruction") == 0) continue;
+
+        if (!read_sysfs_value(cpu, index, "coherency_line_size", buf, sizeof(buf))) return false;
+        line_size = strtoul(buf, NULL, 10);
+        if (!read_sysfs_value(cpu, index, "number_of_sets", buf, sizeof(buf))) return false;
+        sets = strtoul(buf, NULL, 10);
+        if (!read_sysfs_value(cpu, index, "ways_of_associativity", buf, sizeof(buf))) return false;
+        ways = strtoul(buf, NULL, 10);
+
+        if (line_size == 0 || sets == 0 || ways == 0) return false;
+        *out = make_level(level, line_size, sets, ways);
+        return true;
+    }
+    return false;
+}
+
+static void discover_cache_geometry()
+{
+    const char* env = getenv("SPECTRE_EVICTION_LEVEL");
+    unsigned evict_level = env != NULL ? strtoul(env, NULL, 10) : DEFAULT_EVICTION_LEVEL;
+    int cpu = sched_getcpu();
+    geometry.cpu = cpu < 0 ? 0 : cpu;
+
+    if (read_module_level(geometry.cpu, 1, &geometry.l1d) && read_module_level(geometry.cpu, evict_level, &geometry.evict)) {
+        geometry.source = "labspectrekm";
+    }
+    else if (read_sysfs_level(geometry.cpu, 1, &geometry.l1d) && read_sysfs_level(geometry.cpu, evict_level, &geometry.evict)) {
+        geometry.source = "sysfs";
+    }
+    else {
+        geometry.l1d = make_level(1, CACHE_LINE_SIZE, DEFAULT_L1D_SETS, DEFAULT_L1D_WAYS);
+        geometry.evict = make_level(2, CACHE_LINE_SIZE, DEFAULT_L2_SETS, DEFAULT_L2_WAYS);
+        geometry.source = "defaults";
+    }
+
+    // Eviction sets hold at most EVSET_MAX_LINES lines
+    if (geometry.evict.ways > EVSET_MAX_LINES) {
+        geometry.evict.ways = EVSET_MAX_LINES;
+        geometry.evict.size = geometry.evict.line_size * geometry.evict.sets * geometry.evict.ways;
+    }
+}
+
+const CacheGeometry* cache_geometry()
+{
+    pthread_once(&geometry_once, discover_cache_geometry);
+    return &geometry;
+}
+
+static void print_cache_level(const char* name, const CacheLevel* level)
+{
+    printf("%s: L%u, %zu KB (%zu sets x %zu ways x %zu B lines)\n", name, level->level,
+        level->size / 1024, level->sets, level->ways, level->line_size);
+}
+
+void print_cache_geometry(const CacheGeometry* geometry)
+{
+    printf("Cache geometry of cpu%d from %s\n", geometry->cpu, geometry->source);
+    print_cache_level("L1D", &geometry->l1d);
+    print_cache_level("Eviction level", &geometry->evict);
+}
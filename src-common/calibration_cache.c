@@ -0,0 +1,139 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include "calibration_cache.h"
+#include "spectre_timer.h"
+
+#define CALIBRATION_MAGIC 0x4c41434c53485053ULL // "SPHSLCAL"
+// 2: calibrations are per timer backend
+#define CALIBRATION_VERSION 2
+
+typedef struct
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t stats_size;
+    char key[CALIBRATION_KEY_LEN];
+} CalibrationFileHeader;
+
+/*
+ * append_file_line
+ * appends the first line of path (or of the first line in it starting with prefix) to key
+ */
+static void append_file_line(char* key, size_t len, const char* path, const char* prefix)
+{
+    char line[256];
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        strncat(key, "none;", len - strlen(key) - 1);
+        return;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (prefix == NULL || strncmp(line, prefix, strlen(prefix)) == 0) {
+            line[strcspn(line, "\n")] = ';';
+            strncat(key, line, len - strlen(key) - 1);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+void machine_key(char* key, size_t len)
+{
+    struct utsname name;
+    char part[128];
+    key[0] = '\0';
+
+    // CPU model (arm64 reports implementer/part, x86 reports a model name)
+    append_file_line(key, len, "/proc/cpuinfo", "CPU implementer");
+    append_file_line(key, len, "/proc/cpuinfo", "CPU part");
+    append_file_line(key, len, "/proc/cpuinfo", "model name");
+
+    if (uname(&name) == 0) {
+        snprintf(part, sizeof(part), "%s %s;", name.release, name.machine);
+        strncat(key, part, len - strlen(key) - 1);
+    }
+
+    append_file_line(key, len, "/sys/module/labspectrekm/version", NULL);
+}
+
+void calibration_key(char* key, size_t len)
+{
+    char part[32];
+    machine_key(key, len);
+    snprintf(part, sizeof(part), "core %d;", sched_getcpu());
+    strncat(key, part, len - strlen(key) - 1);
+    // The threshold and histograms are in the backend's ticks
+    strncat(key, "timer ", len - strlen(key) - 1);
+    strncat(key, active_timer_backend()->name, len - strlen(key) - 1);
+}
+
+const char* calibration_dir()
+{
+    const char* dir = getenv("SPECTRE_CALIBRATION_DIR");
+    return dir ? dir : CALIBRATION_DEFAULT_DIR;
+}
+
+static void calibration_path(char* path, size_t len)
+{
+    snprintf(path, len, "%s/.spectre_calibration.cpu%d.%s", calibration_dir(), sched_getcpu(), active_timer_backend()->name);
+}
+
+bool save_cache_stats(const CacheStats* stats)
+{
+    char path[512];
+    CalibrationFileHeader header = {
+        .magic = CALIBRATION_MAGIC,
+        .version = CALIBRATION_VERSION,
+        .stats_size = sizeof(CacheStats),
+    };
+    calibration_key(header.key, sizeof(header.key));
+    calibration_path(path, sizeof(path));
+
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(stats, sizeof(*stats), 1, f) == 1;
+    fclose(f);
+    return ok;
+}
+
+bool load_cache_stats(CacheStats* stats)
+{
+    char path[512];
+    char key[CALIBRATION_KEY_LEN];
+    CalibrationFileHeader header;
+    calibration_key(key, sizeof(key));
+    calibration_path(path, sizeof(path));
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return false;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+        header.magic == CALIBRATION_MAGIC &&
+        header.version == CALIBRATION_VERSION &&
+        header.stats_size == sizeof(CacheStats) &&
+        strncmp(header.key, key, sizeof(key)) == 0 &&
+        fread(stats, sizeof(*stats), 1, f) == 1;
+    fclose(f);
+    return ok;
+}
+
+CacheStats load_or_generate_cache_stats(size_t samples)
+{
+    CacheStats stats;
+    if (load_cache_stats(&stats)) {
+        if (validate_cache_stats(&stats, CALIBRATION_VALIDATION_SAMPLES)) {
+            printf("Loaded calibration (threshold %lu)\n", stats.threshold);
+            return stats;
+        }
+        printf("Saved calibration is stale, recalibrating\n");
+    }
+
+    stats = generate_cache_stats(samples);
+    if (!save_cache_stats(&stats)) {
+        fprintf(stderr, "Unable to save calibration\n");
+    }
+    return stats;
+}
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "covert_channel.h"
+#include "spectre_probe.h"
+#include "spectre_timer.h"
+#include "calibration_cache.h"
+#include "spectre_solution.h"
+#include "spectre_environment.h"
+
+// Fixed, so every run sends the same symbols
+#define COVERT_SEED 0x434f564552544348ULL
+// Nobody's turn yet: the receiver hasn't flushed for the first symbol
+#define COVERT_NOT_STARTED SIZE_MAX
+
+typedef struct
+{
+    char* shared_memory;
+    uint64_t threshold;
+    size_t symbols;
+    // sender and receiver share a core, so waiting must give the other one the CPU
+    bool same_core;
+    // 2 * i: the sender's turn to send symbol i, 2 * i + 1: the receiver's turn to read it
+    atomic_size_t turn;
+    size_t errors;
+    uint64_t ns;
+} CovertChannel;
+
+typedef struct
+{
+    CovertChannel* channel;
+    int core;
+} CovertThread;
+
+static uint64_t next_symbol(uint64_t* state)
+{
+    return next_random(state) % PROBE_NUM_LINES;
+}
+
+static void pin_thread(int core, const char* who)
+{
+    if (!pin_to_core(core)) {
+        fprintf(stderr, "[Covert] Unable to pin the %s to core %d\n", who, core);
+    }
+}
+
+static void wait_for_turn(CovertChannel* channel, size_t turn)
+{
+    while (atomic_load_explicit(&channel->turn, memory_order_acquire) != turn) {
+        if (channel->same_core) sched_yield();
+    }
+}
+
+static void* covert_sender(void* arg)
+{
+    CovertThread* self = arg;
+    CovertChannel* channel = self->channel;
+    uint64_t state = COVERT_SEED;
+    pin_thread(self->core, "sender");
+
+    for (size_t i = 0; i < channel->symbols; i++) {
+        uint64_t symbol = next_symbol(&state);
+        wait_for_turn(channel, 2 * i);
+        *(volatile char*)&channel->shared_memory[symbol * SHD_SPECTRE_LAB_PAGE_SIZE];
+        atomic_store_explicit(&channel->turn, 2 * i + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static void* covert_receiver(void* arg)
+{
+    CovertThread* self = arg;
+    CovertChannel* channel = self->channel;
+    uint64_t timings[PROBE_NUM_LINES];
+    uint64_t state = COVERT_SEED;
+    pin_thread(self->core, "receiver");
+
+    uint64_t start_ns = monotonic_ns();
+    for (size_t i = 0; i < channel->symbols; i++) {
+        uint64_t symbol = next_symbol(&state);
+        flush_probe_lines(channel->shared_memory, PROBE_NUM_LINES);
+        atomic_store_explicit(&channel->turn, 2 * i, memory_order_release);
+        wait_for_turn(channel, 2 * i + 1);
+
+        // Same decoding as an attacker sweep: the fastest line, if it is a hit at all
+        reload_probe_lines(channel->shared_memory, timings, PROBE_NUM_LINES);
+        size_t received = probe_fastest_line(timings, PROBE_NUM_LINES);
+        if (received != symbol || timings[received] > channel->threshold) {
+            channel->errors++;
+        }
+    }
+    channel->ns = monotonic_ns() - start_ns;
+    return NULL;
+}
+
+/*
+ * symmetric_capacity
+ * bits per symbol of an M-ary symmetric channel that gets a symbol wrong with
+ * probability p: log2 M + (1 - p) log2 (1 - p) + p log2 (p / (M - 1))
+ */
+static double symmetric_capacity(double p, double m)
+{
+    double bits = log2(m);
+    if (p > 0.0) bits += p * log2(p / (m - 1));
+    if (p < 1.0) bits += (1 - p) * log2(1 - p);
+    return bits > 0.0 ? bits : 0.0;
+}
+
+CovertResult measure_covert_channel(char* shared_memory, uint64_t threshold, int sender_core, int receiver_core,
+                                    const CovertConfig* config)
+{
+    pthread_t sender, receiver;
+    CovertChannel channel = {
+        .shared_memory = shared_memory,
+        .threshold = threshold,
+        .symbols = config->symbols,
+        .same_core = sender_core == receiver_core,
+    };
+    CovertThread sender_thread = { .channel = &channel, .core = sender_core };
+    CovertThread receiver_thread = { .channel = &channel, .core = receiver_core };
+    atomic_init(&channel.turn, COVERT_NOT_STARTED);
+
+    if (pthread_create(&sender, NULL, covert_sender, &sender_thread) != 0 ||
+        pthread_create(&receiver, NULL, covert_receiver, &receiver_thread) != 0) {
+        perror("pthread_create() error");
+        exit(EXIT_FAILURE);
+    }
+    pthread_join(sender, NULL);
+    pthread_join(receiver, NULL);
+
+    CovertResult result = {
+        .sender_core = sender_core,
+        .receiver_core = receiver_core,
+        .symbols = channel.symbols,
+        .errors = channel.errors,
+        .ns = channel.ns,
+    };
+    result.symbols_per_second = result.ns ? result.symbols / (result.ns / 1e9) : 0.0;
+    result.error_rate = result.symbols ? (double)result.errors / result.symbols : 0.0;
+    result.bits_per_symbol = symmetric_capacity(result.error_rate, PROBE_NUM_LINES);
+    result.bits_per_second = result.bits_per_symbol * result.symbols_per_second;
+    return result;
+}
+
+static void print_covert_result(const char* name, const CovertResult* result)
+{
+    printf("[Covert] %s (core %d -> core %d): %zu symbols in %.3f s, %.0f symbols/s, "
+           "symbol error rate %.6f, %.3f bits/symbol, %.0f bits/s after errors\n",
+        name, result->sender_core, result->receiver_core, result->symbols, result->ns / 1e9,
+        result->symbols_per_second, result->error_rate, result->bits_per_symbol, result->bits_per_second);
+    fflush(stdout);
+}
+
+int run_covert_channel(char* shared_memory, const ParallelConfig* parallel, const CovertConfig* config)
+{
+    CacheStats cache_stats = load_or_generate_cache_stats(1000);
+    int first_core = parallel->num_workers > 0 ? parallel->cores[0] : sched_getcpu();
+    int second_core = parallel->num_workers > 1 ? parallel->cores[1] : next_allowed_core(first_core);
+
+    CovertResult same = measure_covert_channel(shared_memory, cache_stats.threshold, first_core, first_core, config);
+    print_covert_result("same core", &same);
+
+    if (second_core != first_core) {
+        CovertResult cross = measure_covert_channel(shared_memory, cache_stats.threshold, first_core, second_core, config);
+        print_covert_result("cross core", &cross);
+    } else {
+        printf("[Covert] cross core: skipped, no other core we may run on\n");
+    }
+
+    destroy_cache_stats(cache_stats);
+    return EXIT_SUCCESS;
+}
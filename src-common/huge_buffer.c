@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "huge_buffer.h"
+#include "eviction_set.h"
+#include "labspectreipc.h"
+
+#define ALIGN_UP(x, alignment) (((x) + (alignment) - 1) & ~((uint64_t)(alignment) - 1))
+
+const char* buffer_backing_name(BufferBacking backing)
+{
+    switch (backing) {
+        case BUFFER_HUGETLB: return "hugetlbfs";
+        case BUFFER_THP: return "transparent huge pages";
+        default: return "4 KB pages";
+    }
+}
+
+/*
+ * map_hugetlb
+ * hugetlb mappings are always huge page aligned, so no slack is needed. MAP_POPULATE
+ * also makes a short reservation fail here instead of with SIGBUS on first touch.
+*/
+static bool map_hugetlb(size_t size, HugeBuffer* out)
+{
+    size_t mapping_size = ALIGN_UP(size, HUGE_PAGE_SIZE);
+    void* mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+                         MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (mapping == MAP_FAILED) return false;
+
+    out->mapping = mapping;
+    out->mapping_size = mapping_size;
+    out->addr = mapping;
+    out->backing = BUFFER_HUGETLB;
+    return true;
+}
+
+/*
+ * map_aligned
+ * over-allocates by a huge page so the buffer can start on a huge page boundary,
+ * then asks for THP on the aligned part. MAP_POPULATE would fault the THP case in
+ * as 4 KB pages before madvise gets to run, so that case is populated afterwards.
+*/
+static bool map_aligned(size_t size, bool want_thp, HugeBuffer* out)
+{
+    size_t mapping_size = ALIGN_UP(size, HUGE_PAGE_SIZE) + HUGE_PAGE_SIZE;
+    void* mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+                         MAP_ANONYMOUS | MAP_PRIVATE | (want_thp ? 0 : MAP_POPULATE), -1, 0);
+    if (mapping == MAP_FAILED) return false;
+
+    out->mapping = mapping;
+    out->mapping_size = mapping_size;
+    out->addr = (char*)ALIGN_UP((uint64_t)mapping, HUGE_PAGE_SIZE);
+    out->backing = BUFFER_SMALL_PAGES;
+#ifdef MADV_HUGEPAGE
+    if (want_thp && madvise(out->addr, ALIGN_UP(size, HUGE_PAGE_SIZE), MADV_HUGEPAGE) == 0) {
+        out->backing = BUFFER_THP;
+    }
+#endif
+#ifdef MADV_POPULATE_WRITE
+    if (want_thp) madvise(out->addr, ALIGN_UP(size, HUGE_PAGE_SIZE), MADV_POPULATE_WRITE);
+#endif
+    return true;
+}
+
+/*
+ * smaps_huge_bytes
+ * AnonHugePages of the mapping that contains addr, in bytes
+*/
+static size_t smaps_huge_bytes(void* addr)
+{
+    FILE* smaps = fopen("/proc/self/smaps", "r");
+    char line[256];
+    bool in_mapping = false;
+    size_t huge_kb = 0;
+
+    if (smaps == NULL) return 0;
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            in_mapping = (uint64_t)addr >= start && (uint64_t)addr < end;
+        }
+        else if (in_mapping && sscanf(line, "AnonHugePages: %zu kB", &huge_kb) == 1) {
+            break;
+        }
+    }
+    fclose(smaps);
+    return huge_kb * 1024;
+}
+
+/*
+ * check_contiguity
+ * every 4 KB page should follow the previous one physically
+*/
+static void check_contiguity(HugeBuffer* buffer)
+{
+    uint64_t first = virt_to_phys(buffer->addr);
+    buffer->pagemap_checked = first != 0;
+    buffer->contiguous = buffer->pagemap_checked;
+    if (!buffer->pagemap_checked) return;
+
+    for (size_t off = SHD_SPECTRE_LAB_PAGE_SIZE; off < buffer->size; off += SHD_SPECTRE_LAB_PAGE_SIZE) {
+        if (virt_to_phys(buffer->addr + off) != first + off) {
+            buffer->contiguous = false;
+            return;
+        }
+    }
+}
+
+HugeBuffer allocate_huge_buffer(size_t size)
+{
+    HugeBuffer buffer = { .size = size };
+
+    fflush(stdout);
+    if (!map_hugetlb(size, &buffer) && !map_aligned(size, true, &buffer) && !map_aligned(size, false, &buffer)) {
+        perror("mmap() error");
+        exit(EXIT_FAILURE);
+    }
+
+    // The first access to a page triggers overhead associated with
+    // page allocation, TLB insertion, etc.
+    // Thus, we use a dummy write here to trigger page allocation
+    // so later access will not suffer from such overhead.
+    // (Already populated above where the kernel supports it, this also fills the TLB.)
+    for (size_t i = 0; i < size; i += CACHE_LINE_SIZE) {
+        buffer.addr[i] = 1;
+    }
+
+    if (buffer.backing == BUFFER_HUGETLB) {
+        buffer.huge_bytes = size;
+    } else {
+        // the mapping may have been merged with a neighbour, so only count up to our size
+        buffer.huge_bytes = smaps_huge_bytes(buffer.addr);
+        if (buffer.huge_bytes > size) buffer.huge_bytes = size;
+        // madvise succeeds even when THP is disabled or no huge page was free
+        if (buffer.huge_bytes == 0) buffer.backing = BUFFER_SMALL_PAGES;
+    }
+    check_contiguity(&buffer);
+    return buffer;
+}
+
+void free_huge_buffer(HugeBuffer* buffer)
+{
+    if (buffer->mapping != NULL) {
+        munmap(buffer->mapping, buffer->mapping_size);
+    }
+    *buffer = (HugeBuffer) { 0 };
+}
+
+void print_huge_buffer(const char* name, const HugeBuffer* buffer)
+{
+    printf("%s: %p, %zu KB on %s (%zu KB huge), %s\n", name, buffer->addr, buffer->size / 1024,
+        buffer_backing_name(buffer->backing), buffer->huge_bytes / 1024,
+        !buffer->pagemap_checked ? "contiguity unknown (pagemap hides PFNs)" :
+        buffer->contiguous ? "physically contiguous" : "not physically contiguous");
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "latency_histogram.h"
+
+void histogram_reset(LatencyHistogram* hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+void histogram_add(LatencyHistogram* hist, uint64_t latency)
+{
+    if (latency >= HISTOGRAM_BUCKETS) latency = HISTOGRAM_BUCKETS - 1;
+    hist->buckets[latency]++;
+    hist->count++;
+}
+
+void histogram_decay(LatencyHistogram* hist)
+{
+    hist->count = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        hist->buckets[i] /= 2;
+        hist->count += hist->buckets[i];
+    }
+}
+
+uint64_t histogram_percentile(const LatencyHistogram* hist, double percent)
+{
+    if (hist->count == 0) return 0;
+    uint64_t target = (uint64_t)(hist->count * percent / 100.0);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen > target || seen == hist->count) return i;
+    }
+    return HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t histogram_otsu_threshold(const LatencyHistogram* hits, const LatencyHistogram* misses)
+{
+    double total = (double)hits->count + (double)misses->count;
+    double sum_all = 0.0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        sum_all += (double)i * ((double)hits->buckets[i] + misses->buckets[i]);
+    }
+
+    double weight_low = 0.0, sum_low = 0.0, best_variance = -1.0;
+    uint64_t best = 0, best_end = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        double n = (double)hits->buckets[i] + misses->buckets[i];
+        weight_low += n;
+        sum_low += (double)i * n;
+        double weight_high = total - weight_low;
+        if (weight_low == 0.0) continue;
+        if (weight_high == 0.0) break;
+
+        double mean_low = sum_low / weight_low;
+        double mean_high = (sum_all - sum_low) / weight_high;
+        double variance = weight_low * weight_high * (mean_low - mean_high) * (mean_low - mean_high);
+        if (variance > best_variance) {
+            best_variance = variance;
+            best = best_end = i;
+        } else if (variance == best_variance && best_end == i - 1) {
+            // empty buckets between the two modes: keep extending the plateau
+            best_end = i;
+        }
+    }
+    // split in the middle of the gap for the most margin on both sides
+    return (best + best_end) / 2;
+}
+
+void histogram_print(const LatencyHistogram* hist)
+{
+    bool first = true;
+    printf("[");
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (hist->buckets[i] == 0) continue;
+        printf("%s%zu:%u", first ? "" : ",", i, hist->buckets[i]);
+        first = false;
+    }
+    printf("]\n");
+}
@@ -12,43 +12,254 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <libgen.h>
 
 #include "labspectre.h"
 #include "labspectreipc.h"
+#include "spectre_solution.h"
+#include "spectre_bench.h"
+#include "spectre_attacker.h"
+#include "parallel_leak.h"
+#include "spectre_timer.h"
+#include "spectre_victim.h"
+#include "huge_buffer.h"
+#include "eviction_profile.h"
+#include "cache_geometry.h"
+#include "spectre_tuning.h"
+#include "covert_channel.h"
+#include "spectre_environment.h"
 
 /*
  * main
  * Setup shared memory and launch student code.
+ *
+ * Usage: spectre <part1|part2|part3> [options]
+ * When the binary itself is called part1/ part2/ part3 the part can be left out.
  */
 int main(int argc, char *argv[])
 {
-    if (argc == 2) {
-        if (strcmp(argv[1], "--eviction-graph") == 0) {
-            print_python_eviction_set_graph();
+    BenchConfig bench = { .trials = 0, .secret = NULL, .out = stdout, .oracle_sweeps = BENCH_DEFAULT_ORACLE_SWEEPS,
+                          .store_bytes = 0, .store_seed = 0 };
+    const AttackerPart *part = find_attacker_part(basename(argv[0]));
+    size_t trials = 1;
+    EvictionProfileConfig profile = default_eviction_profile_config();
+    bool run_profile = false;
+    bool autotune = false;
+    AutotuneConfig tune = { .num_candidates = AUTOTUNE_DEFAULT_CANDIDATES, .initial_bytes = AUTOTUNE_DEFAULT_BYTES, .secret = NULL };
+    FILE* profile_out = stdout;
+    CovertConfig covert = { .symbols = 0 };
+    int first_option = 1;
+
+    if (argc > 1 && argv[1][0] != '-') {
+        part = find_attacker_part(argv[1]);
+        if (part == NULL) {
+            fprintf(stderr, "Unknown part '%s' (expected part1, part2 or part3)\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+        first_option = 2;
+    }
+
+    for (int i = first_option; i < argc; i++) {
+        if (strcmp(argv[i], "--eviction-profile") == 0) {
+            // Characterize the cache instead of attacking
+            run_profile = true;
+        }
+        else if (strcmp(argv[i], "--profile-range") == 0 && i + 1 < argc) {
+            run_profile = true;
+            if (!parse_profile_range(argv[++i], &profile)) {
+                fprintf(stderr, "Invalid set range '%s' (expected FIRST:LAST[:STEP] within 0:%zu)\n", argv[i], cache_geometry()->evict.sets);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--profile-trials") == 0 && i + 1 < argc) {
+            run_profile = true;
+            profile.trials = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--profile-output") == 0 && i + 1 < argc) {
+            run_profile = true;
+            profile_out = fopen(argv[++i], "w");
+            if (profile_out == NULL) {
+                perror("Unable to open profile output");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--covert-channel") == 0) {
+            // Measure the bare Flush+Reload channel instead of attacking
+            covert.symbols = COVERT_DEFAULT_SYMBOLS;
+        }
+        else if (strcmp(argv[i], "--covert-symbols") == 0 && i + 1 < argc) {
+            covert.symbols = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--list-timers") == 0) {
+            print_timer_backends();
             return 0;
         }
+        else if (strcmp(argv[i], "--timer") == 0 && i + 1 < argc) {
+            // Use a specific timer backend instead of the build default
+            if (!select_timer_backend(argv[++i])) {
+                fprintf(stderr, "Timer '%s' is unknown or unavailable (see --list-timers)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+            // Leak in parallel, one worker pinned to each listed core
+            if (!parse_core_list(argv[++i], &parallel_config)) {
+                fprintf(stderr, "Invalid core list '%s' (expected e.g. 0,1,2,3)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--pin-core") == 0 && i + 1 < argc) {
+            // Run on this core instead of the one we were started on
+            if (!parse_pin_core(argv[++i], &environment_config.core)) {
+                fprintf(stderr, "Invalid core '%s'\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            environment_config.pin = true;
+        }
+        else if (strcmp(argv[i], "--no-pin") == 0) {
+            environment_config.pin = false;
+        }
+        else if (strcmp(argv[i], "--fifo") == 0 && i + 1 < argc) {
+            // Real-time priority, so nothing else preempts a sweep (needs root)
+            if (!parse_fifo_priority(argv[++i], &environment_config.fifo_priority)) {
+                fprintf(stderr, "Invalid SCHED_FIFO priority '%s' (expected 1 to 99)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--no-mlock") == 0) {
+            environment_config.lock_memory = false;
+        }
+        else if (strcmp(argv[i], "--victim") == 0 && i + 1 < argc) {
+            // Run the gadgets in the kernel module or in the user space stand-in
+            if (!parse_victim_mode(argv[++i], &victim_mode)) {
+                fprintf(stderr, "Unknown victim '%s' (expected kernel, thread or direct)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--radix") == 0 && i + 1 < argc) {
+            // Leak every byte as bit-fields with this many probe lines each
+            if (!parse_probe_radix(argv[++i], &probe_field_bits)) {
+                fprintf(stderr, "Unsupported radix '%s' (expected 2, 4, 16 or 256)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc) {
+            // Leak the secret N times in this process
+            trials = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            // Benchmark N trials instead of leaking once
+            bench.trials = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--store-bytes") == 0 && i + 1 < argc) {
+            // Benchmark leaking this many bytes of the victim's secret store
+            bench.store_bytes = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--store-seed") == 0 && i + 1 < argc) {
+            bench.store_seed = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--secret") == 0 && i + 1 < argc) {
+            bench.secret = argv[++i];
+            tune.secret = bench.secret;
+        }
+        else if (strcmp(argv[i], "--autotune") == 0) {
+            // Search for the fastest attack parameters and save them for later runs
+            autotune = true;
+        }
+        else if (strcmp(argv[i], "--tune-candidates") == 0 && i + 1 < argc) {
+            autotune = true;
+            tune.num_candidates = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--tune-bytes") == 0 && i + 1 < argc) {
+            // Bytes each configuration leaks in the first round
+            autotune = true;
+            tune.initial_bytes = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--oracle-sweeps") == 0 && i + 1 < argc) {
+            // Sweeps per byte scored against the victim's ground truth (0 to skip)
+            bench.oracle_sweeps = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--bench-output") == 0 && i + 1 < argc) {
+            bench.out = fopen(argv[++i], "w");
+            if (bench.out == NULL) {
+                perror("Unable to open benchmark output");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else {
+            fprintf(stderr, "Usage: %s <part1|part2|part3> [--trials N] [--timer NAME] [--cores LIST]\n"
+                            "          [--victim kernel|thread|direct] [--radix 2|4|16|256]\n"
+                            "          [--pin-core N | --no-pin] [--fifo PRIORITY] [--no-mlock]\n"
+                            "          [--bench TRIALS [--secret SECRET] [--bench-output FILE] [--oracle-sweeps N]]\n"
+                            "          [--store-bytes N [--store-seed SEED] [--bench TRIALS] [--bench-output FILE]]\n"
+                            "          [--autotune [--secret SECRET] [--tune-candidates N] [--tune-bytes N]]\n"
+                            "          [--list-timers]\n"
+                            "       %s --eviction-profile [--profile-range FIRST:LAST[:STEP]] [--profile-trials N]\n"
+                            "          [--profile-output FILE] [--timer NAME] [--cores LIST]\n"
+                            "       %s --covert-channel [--covert-symbols N] [--timer NAME] [--cores SENDER,RECEIVER]\n", argv[0], argv[0], argv[0]);
+            exit(EXIT_FAILURE);
+        }
     }
-    char *shared_memory;
-    int kernel_fd;
+    // Before anything is allocated or timed: pages mapped later are locked too,
+    // and the victim thread inherits our core and scheduling policy
+    setup_environment(&environment_config);
 
-    // Open a file descriptor to the kernel
-    kernel_fd = open("/proc/" SHD_PROCFS_NAME, O_RDWR);
-    if (kernel_fd < 0) {
-        perror("Problem connecting to the kernel module- did you install it?\n");
+    if (run_profile) {
+        run_eviction_profile(&profile, &parallel_config, profile_out);
+        return 0;
+    }
+    if (part == NULL && covert.symbols == 0) {
+        fprintf(stderr, "Which part? Usage: %s <part1|part2|part3> [options]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
+    char *shared_memory;
+    int kernel_fd;
+
+    TimerProperties timer = measure_timer_backend(active_timer_backend());
+    printf("Timer: %s (overhead %lu ticks, resolution %lu ticks = %.2f ns)\n",
+        active_timer_backend()->name, timer.overhead, timer.resolution, timer.resolution / timer.ticks_per_ns);
 
     // Create some shared memory that will be shared by both client and server
-    shared_memory = mmap(NULL, SHD_SPECTRE_LAB_SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
+    // Huge page backed when possible, so reloading the 256 probe pages doesn't miss in the TLB
+    HugeBuffer probe_buffer = allocate_huge_buffer(SHD_SPECTRE_LAB_SHARED_MEMORY_SIZE);
+    shared_memory = probe_buffer.addr;
+    print_huge_buffer("Probe Region", &probe_buffer);
+
+    // Setup memory
+    init_shared_memory(shared_memory, SHD_SPECTRE_LAB_SHARED_MEMORY_SIZE);
+
+    // The channel alone needs no victim
+    if (covert.symbols > 0) {
+        return run_covert_channel(shared_memory, &parallel_config, &covert);
+    }
 
-    if (NULL == shared_memory) {
-        perror("mmap() error");
+    // Open a file descriptor to the kernel (or to its user space stand-in)
+    kernel_fd = open_victim(victim_mode);
+    if (kernel_fd < 0) {
+        if (victim_mode == VICTIM_KERNEL) {
+            perror("Problem connecting to the kernel module- did you install it?\n");
+        } else {
+            perror("Problem starting the user space victim");
+        }
         exit(EXIT_FAILURE);
     }
+    printf("Victim: %s\n", victim_mode_name(victim_mode));
 
-    // Setup memory
-    init_shared_memory(shared_memory, SHD_SPECTRE_LAB_SHARED_MEMORY_SIZE);
+    // Pin the shared memory in the kernel once instead of on every command,
+    // and only as many pages as the encoding needs
+    register_shared_memory(kernel_fd, shared_memory, probe_field_lines(probe_field_bits));
+
+    if (autotune) {
+        return run_autotune(part, kernel_fd, shared_memory, &tune);
+    }
+    // A store benchmark leaks the store once unless --bench says otherwise
+    if (bench.store_bytes > 0 && bench.trials == 0) {
+        bench.trials = 1;
+    }
+    if (bench.trials > 0) {
+        return run_benchmark(part, kernel_fd, shared_memory, &bench);
+    }
 
     // Run the attacker code :)
-    return run_attacker(kernel_fd, shared_memory);
+    return run_attacker(part, kernel_fd, shared_memory, trials);
 }
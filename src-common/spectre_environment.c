@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "spectre_environment.h"
+#include "spectre_timer.h"
+
+EnvironmentConfig environment_config = {
+    .pin = true,
+    .core = ENVIRONMENT_CURRENT_CORE,
+    .fifo_priority = 0,
+    .lock_memory = true,
+};
+EnvironmentReport environment_report = { .core = -1 };
+
+// The CPUs we may run on, saved before pinning narrows them to one
+static cpu_set_t allowed_cpus;
+static bool allowed_cpus_saved = false;
+
+static void environment_warning(EnvironmentReport* report, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    printf("Environment warning: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    report->warnings++;
+}
+
+static bool read_sysfs_line(const char* path, char* buf, size_t len)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return false;
+    bool ok = fgets(buf, len, f) != NULL;
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return ok;
+}
+
+static bool read_cpu_value(int cpu, const char* name, char* buf, size_t len)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+    return read_sysfs_line(path, buf, len);
+}
+
+// a cpufreq frequency in kHz, 0 if it isn't exposed
+static unsigned long read_cpu_khz(int cpu, const char* name)
+{
+    char buf[32];
+    return read_cpu_value(cpu, name, buf, sizeof(buf)) ? strtoul(buf, NULL, 10) : 0;
+}
+
+bool parse_fifo_priority(const char* arg, int* out)
+{
+    char* end;
+    long priority = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0') return false;
+    if (priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO)) return false;
+    *out = (int)priority;
+    return true;
+}
+
+bool parse_pin_core(const char* arg, int* out)
+{
+    char* end;
+    long core = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || core < 0 || core >= sysconf(_SC_NPROCESSORS_CONF)) return false;
+    *out = (int)core;
+    return true;
+}
+
+bool pin_to_core(int core)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+static void save_allowed_cpus(void)
+{
+    if (allowed_cpus_saved) return;
+    CPU_ZERO(&allowed_cpus);
+    allowed_cpus_saved = sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) == 0;
+}
+
+int next_allowed_core(int core)
+{
+    save_allowed_cpus();
+    if (!allowed_cpus_saved) return core;
+    for (int i = 1; i < CPU_SETSIZE; i++) {
+        int next = (core + i) % CPU_SETSIZE;
+        if (CPU_ISSET(next, &allowed_cpus)) return next;
+    }
+    return core;
+}
+
+static void pin_environment(const EnvironmentConfig* config, EnvironmentReport* report)
+{
+    int core = config->core == ENVIRONMENT_CURRENT_CORE ? sched_getcpu() : config->core;
+    if (!pin_to_core(core)) {
+        environment_warning(report, "unable to pin to core %d (%s), sweeps may migrate between cores", core, strerror(errno));
+        return;
+    }
+    report->pinned = true;
+}
+
+static void switch_to_fifo(int priority, EnvironmentReport* report)
+{
+    struct sched_param param = { .sched_priority = priority };
+    if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+        environment_warning(report, "SCHED_FIFO priority %d unavailable (%s), other tasks can preempt a sweep", priority, strerror(errno));
+        return;
+    }
+    report->fifo = true;
+}
+
+/*
+ * lock_memory
+ * With MCL_FUTURE every later mapping counts against RLIMIT_MEMLOCK and fails once
+ * the limit is used up, so memory is only locked when the limit can't get in the way.
+ * MCL_ONFAULT keeps mmap from faulting new mappings in as 4 KB pages before
+ * allocate_huge_buffer can ask for THP; it populates its buffers itself.
+ */
+static void lock_memory(EnvironmentReport* report)
+{
+    struct rlimit limit;
+    if (geteuid() != 0 && getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        if (limit.rlim_max == RLIM_INFINITY) {
+            limit.rlim_cur = RLIM_INFINITY;
+            setrlimit(RLIMIT_MEMLOCK, &limit);
+        } else {
+            environment_warning(report, "memory not locked, RLIMIT_MEMLOCK is %lu KB (run as root or with ulimit -l unlimited)",
+                (unsigned long)(limit.rlim_cur / 1024));
+            return;
+        }
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0) {
+        environment_warning(report, "mlockall() failed (%s), probe or eviction pages may be paged out", strerror(errno));
+        return;
+    }
+    report->memory_locked = true;
+}
+
+/*
+ * check_frequency
+ * reads the governor and the core frequency before and after spinning for
+ * ENVIRONMENT_WARMUP_MS, which shows how far an on-demand governor ramps
+ */
+static void check_frequency(EnvironmentReport* report)
+{
+    int cpu = report->core;
+    char boost[8];
+
+    if (!read_cpu_value(cpu, "cpufreq/scaling_governor", report->governor, sizeof(report->governor))) {
+        report->governor[0] = '\0';
+        return;
+    }
+    report->idle_khz = read_cpu_khz(cpu, "cpufreq/scaling_cur_freq");
+    uint64_t end_ns = monotonic_ns() + ENVIRONMENT_WARMUP_MS * 1000000ULL;
+    while (monotonic_ns() < end_ns);
+    report->cur_khz = read_cpu_khz(cpu, "cpufreq/scaling_cur_freq");
+    report->max_khz = read_cpu_khz(cpu, "cpufreq/cpuinfo_max_freq");
+
+    if (strcmp(report->governor, "performance") != 0) {
+        environment_warning(report, "core %d uses the %s cpufreq governor, its clock changes while the attack runs "
+            "(echo performance > /sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor)", cpu, report->governor, cpu);
+    }
+    if (report->max_khz > 0 && report->cur_khz < report->max_khz * ENVIRONMENT_MIN_FREQ_FRACTION) {
+        environment_warning(report, "core %d runs at %lu of %lu MHz after warming up (throttled, or scaling_max_freq is capped)",
+            cpu, report->cur_khz / 1000, report->max_khz / 1000);
+    }
+    if ((read_sysfs_line("/sys/devices/system/cpu/cpufreq/boost", boost, sizeof(boost)) && strcmp(boost, "1") == 0) ||
+        (read_sysfs_line("/sys/devices/system/cpu/intel_pstate/no_turbo", boost, sizeof(boost)) && strcmp(boost, "0") == 0)) {
+        environment_warning(report, "frequency boost is on, the clock follows temperature and how many cores are busy");
+    }
+}
+
+/*
+ * count_list
+ * number of CPUs in a sysfs CPU list such as "0,4" or "0-3"
+ */
+static size_t count_list(const char* list)
+{
+    size_t count = 0;
+    char* end;
+    while (*list != '\0') {
+        unsigned long first = strtoul(list, &end, 10), last = first;
+        if (end == list) break;
+        if (*end == '-') last = strtoul(end + 1, &end, 10);
+        count += last >= first ? last - first + 1 : 1;
+        if (*end != ',') break;
+        list = end + 1;
+    }
+    return count;
+}
+
+static void check_smt(EnvironmentReport* report)
+{
+    char siblings[64];
+    if (!read_cpu_value(report->core, "topology/thread_siblings_list", siblings, sizeof(siblings))) return;
+
+    size_t count = count_list(siblings);
+    report->smt_siblings = count > 1 ? count - 1 : 0;
+    if (report->smt_siblings > 0) {
+        environment_warning(report, "core %d shares its physical core with %zu other logical CPU(s) (%s), keep them idle or disable SMT",
+            report->core, report->smt_siblings, siblings);
+    }
+}
+
+void setup_environment(const EnvironmentConfig* config)
+{
+    EnvironmentReport* report = &environment_report;
+    *report = (EnvironmentReport) { .core = -1 };
+    save_allowed_cpus();
+
+    if (config->pin) pin_environment(config, report);
+    if (config->fifo_priority > 0) switch_to_fifo(config->fifo_priority, report);
+    if (config->lock_memory) lock_memory(report);
+
+    report->core = sched_getcpu();
+    check_frequency(report);
+    check_smt(report);
+
+    printf("Environment: core %d (%s), %s, memory %s, ", report->core, report->pinned ? "pinned" : "not pinned",
+        report->fifo ? "SCHED_FIFO" : "normal scheduling", report->memory_locked ? "locked" : "not locked");
+    if (report->governor[0] == '\0') {
+        printf("cpufreq not exposed");
+    } else {
+        printf("%s governor, %lu -> %lu of %lu MHz", report->governor,
+            report->idle_khz / 1000, report->cur_khz / 1000, report->max_khz / 1000);
+    }
+    printf(", %zu warning%s\n", report->warnings, report->warnings == 1 ? "" : "s");
+    fflush(stdout);
+}
+
+void print_json_environment(FILE* out)
+{
+    const EnvironmentReport* report = &environment_report;
+    fprintf(out, "    \"environment\": {\"core\": %d, \"pinned\": %s, \"fifo\": %s, \"memory_locked\": %s, "
+                 "\"governor\": \"%s\", \"cur_mhz\": %lu, \"max_mhz\": %lu, \"smt_siblings\": %zu, \"warnings\": %zu},\n",
+        report->core, report->pinned ? "true" : "false", report->fifo ? "true" : "false",
+        report->memory_locked ? "true" : "false", report->governor, report->cur_khz / 1000, report->max_khz / 1000,
+        report->smt_siblings, report->warnings);
+}
@@ -12,30 +12,16 @@
 
 #include "labspectre.h"
 #include "labspectreipc.h"
+#include "spectre_timer.h"
+#include "spectre_victim.h"
 
 /*
  * time_access
- * Returns the time to access an address
+ * Returns the time to access an address, measured with the selected timer backend
  */
 uint64_t time_access(void* addr)
 {
-    char temp;
-    uint64_t start, end;
-    asm volatile(
-        "dsb sy"                "\n\t"
-        "isb"                   "\n\t"
-        "mrs %0, pmccntr_el0"   "\n\t"
-        "isb"                   "\n\t"
-        "ldr %2, [%3]"          "\n\t"
-        "isb"                   "\n\t"
-        "mrs %1, pmccntr_el0"   "\n\t"
-        "isb"                   "\n\t"
-        "dsb sy"                "\n\t"
-        :"=r"(start), "=r"(end),
-         "=r"(temp)
-        :"r"(addr)
-    );
-    return end - start;
+    return active_timer_backend()->time_access(addr);
 }
 
 /*
@@ -55,3 +41,57 @@ void init_shared_memory(char *shared_memory, size_t len) {
         //flush_address(&shared_memory[SHD_SPECTRE_LAB_PAGE_SIZE * i]);
     }
 }
+
+/*
+ * register_shared_memory
+ * Pins and maps shared_memory in the kernel once for the lifetime of kernel_fd.
+ *
+ * Arguments:
+ *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
+ *  - shared_memory: The region that will be passed as arg1 of later commands
+ *  - num_pages: How many of its pages to pin (0 for all of them)
+ *
+ * Returns: None
+ * Side Effects: The region stays pinned until kernel_fd is closed.
+ */
+void register_shared_memory(int kernel_fd, char *shared_memory, size_t num_pages) {
+    spectre_lab_command local_cmd;
+    local_cmd.kind = COMMAND_REGISTER_SHARED_MEMORY;
+    local_cmd.flags = 0;
+    local_cmd.arg1 = (uint64_t)shared_memory;
+    local_cmd.arg2 = num_pages;
+
+    victim_write(kernel_fd, (void *)&local_cmd, sizeof(local_cmd));
+}
+
+/*
+ * submit_command_batch
+ * Sends several commands to the kernel using as few write() calls as possible.
+ *
+ * Arguments:
+ *  - kernel_fd: A file descriptor referring to the lab vulnerable kernel module
+ *  - cmds: The commands to run, in order. They must all share the same arg1.
+ *  - count: Number of commands in cmds
+ *
+ * Returns: None
+ * Side Effects: Runs every command in the kernel.
+ */
+void submit_command_batch(int kernel_fd, const spectre_lab_command *cmds, size_t count) {
+    struct {
+        spectre_lab_batch_header header;
+        spectre_lab_command cmds[SHD_SPECTRE_LAB_MAX_BATCH_LEN];
+    } batch;
+
+    while (count > 0) {
+        size_t chunk = count < SHD_SPECTRE_LAB_MAX_BATCH_LEN ? count : SHD_SPECTRE_LAB_MAX_BATCH_LEN;
+
+        batch.header.magic = SHD_SPECTRE_LAB_BATCH_MAGIC;
+        batch.header.count = chunk;
+        memcpy(batch.cmds, cmds, chunk * sizeof(spectre_lab_command));
+
+        victim_write(kernel_fd, (void *)&batch, sizeof(batch.header) + chunk * sizeof(spectre_lab_command));
+
+        cmds += chunk;
+        count -= chunk;
+    }
+}
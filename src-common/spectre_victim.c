@@ -0,0 +1,429 @@
+/*
+ * spectre_victim
+ * User space stand-in for labspectrekm, so the attack can run (and be measured)
+ * on machines without the kernel module.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "spectre_victim.h"
+#include "spectre_arch.h"
+#include "probe_kernels.h"
+
+VictimMode victim_mode = VICTIM_KERNEL;
+
+// Same secrets and bounds checks as labspectrekm.c
+static volatile char __attribute__((aligned(32768))) victim_secret3[SHD_SPECTRE_LAB_SECRET_MAX_LEN] = "MIT{h4rd3st}";
+static volatile char __attribute__((aligned(32768))) victim_secret2[SHD_SPECTRE_LAB_SECRET_MAX_LEN] = "MIT{scary_sp3ctr3!}";
+static volatile char __attribute__((aligned(32768))) victim_secret1[SHD_SPECTRE_LAB_SECRET_MAX_LEN] = "MIT{k3rn3l_m3m0r135}";
+
+static volatile size_t __attribute__((aligned(32768))) secret_leak_limit_part2 = 4;
+static volatile size_t __attribute__((aligned(32768))) secret_leak_limit_part3 = 4;
+
+// Secret store shared by the user space victims, like the module's. Only replaced
+// by configure_secret_store, which callers must not race with victim calls.
+static volatile char* victim_store = NULL;
+static size_t victim_store_size = 0;
+
+/*
+ * Per victim state, the user space version of spectre_lab_session.
+ * The region is in our own address space, so "mapping" it is just remembering it.
+*/
+typedef struct
+{
+    VictimMode mode;
+    // registered shared memory region (NULL if none)
+    char* mapped_region;
+    // pages of it the victim may touch (SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES when unregistered)
+    size_t num_pages;
+    // the victim thread's end of the socketpair (VICTIM_THREAD only)
+    int victim_socket;
+
+    // oracle ring buffer, like the module's (NULL unless enable_victim_oracle was called)
+    spectre_lab_oracle_record* oracle;
+    uint64_t oracle_head;
+    uint64_t oracle_tail;
+} VictimSession;
+
+static VictimSession victim_sessions[VICTIM_MAX_FDS];
+
+// Largest write we accept: a full batch
+#define VICTIM_MAX_WRITE (sizeof(spectre_lab_batch_header) + SHD_SPECTRE_LAB_MAX_BATCH_LEN * sizeof(spectre_lab_command))
+
+static const char* const victim_mode_names[] = {
+    [VICTIM_KERNEL] = "kernel",
+    [VICTIM_THREAD] = "thread",
+    [VICTIM_DIRECT] = "direct",
+};
+
+bool parse_victim_mode(const char* name, VictimMode* out)
+{
+    for (size_t i = 0; i < sizeof(victim_mode_names) / sizeof(victim_mode_names[0]); i++) {
+        if (strcmp(victim_mode_names[i], name) == 0) {
+            *out = (VictimMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* victim_mode_name(VictimMode mode)
+{
+    return victim_mode_names[mode];
+}
+
+/*
+ * victim_run_command
+ * Same gadgets as spectre_lab_run_command, against the user space region.
+ * Returns the targeted probe line and sets architectural, for the oracle. The
+ * target is only computed when log_target is set (see spectre_lab_run_command).
+*/
+static int victim_run_command(const spectre_lab_command* cmd, char* region, bool* architectural, bool log_target)
+{
+    int target = SHD_SPECTRE_LAB_ORACLE_NO_TARGET;
+    bool from_store = cmd->flags & SHD_SPECTRE_LAB_FLAG_STORE;
+    volatile char* secret;
+    // unsigned like char in the arm64 kernel, so store bytes above 0x7f pass part 1's check
+    unsigned char secret_data;
+    volatile char tmp;
+    size_t long_latency;
+    char* addr_to_leak;
+    unsigned int field_shift, field_mask;
+
+    switch (cmd->kind) {
+        // Part 1 is Flush+Reload, so access a secret without a bounds check
+        case COMMAND_PART1:
+            secret = from_store ? victim_store : victim_secret1;
+            secret_data = secret[cmd->arg2];
+            if (secret_data < SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES) {
+                tmp = region[SHD_SPECTRE_LAB_FIELD(secret_data, cmd->flags) * SHD_SPECTRE_LAB_PAGE_SIZE];
+                target = SHD_SPECTRE_LAB_FIELD(secret_data, cmd->flags);
+            }
+            *architectural = true;
+        break;
+
+        // Part 2 is Spectre, so access a secret bounded by a bounds check
+        case COMMAND_PART2:
+            secret = from_store ? victim_store : victim_secret2;
+            secret_data = secret[cmd->arg2];
+            addr_to_leak = &region[SHD_SPECTRE_LAB_FIELD(secret_data, cmd->flags) * SHD_SPECTRE_LAB_PAGE_SIZE];
+
+            // Flush the limit variable to make this if statement take a long time to resolve
+            arch_flush_line((void*)&secret_leak_limit_part2);
+            if (cmd->arg2 < secret_leak_limit_part2) {
+                tmp = *addr_to_leak;
+            }
+            target = SHD_SPECTRE_LAB_FIELD(secret_data, cmd->flags);
+            *architectural = cmd->arg2 < secret_leak_limit_part2;
+        break;
+
+        // Part 3 is a more difficult version of Spectre
+        case COMMAND_PART3:
+            // No cache flush this time around!
+            secret = from_store ? victim_store : victim_secret3;
+            // Field decoded outside the speculation window, as in the module
+            field_shift = SHD_SPECTRE_LAB_FIELD_SHIFT(cmd->flags);
+            field_mask = SHD_SPECTRE_LAB_FIELD_LINES(cmd->flags) - 1;
+            for (volatile int z = 0; z < 1000; z++);
+            if (cmd->arg2 < secret_leak_limit_part3) {
+                long_latency = cmd->arg2 * 1ULL * 1ULL * 1ULL * 1ULL * 0ULL;
+                tmp = region[(((((unsigned char)secret[cmd->arg2]) >> field_shift) & field_mask) + long_latency) * SHD_SPECTRE_LAB_PAGE_SIZE];
+            }
+            // Loads the secret architecturally, so only for the oracle
+            if (log_target) {
+                target = SHD_SPECTRE_LAB_FIELD(secret[cmd->arg2], cmd->flags);
+            }
+            *architectural = cmd->arg2 < secret_leak_limit_part3;
+        break;
+
+        default:
+            *architectural = false;
+        break;
+    }
+
+    // Training commands must not leave their (architectural) access in the cache
+    if (cmd->flags & SHD_SPECTRE_LAB_FLAG_TRAIN) {
+        probe_flush_lines(region, SHD_SPECTRE_LAB_PAGE_SIZE, SHD_SPECTRE_LAB_FIELD_LINES(cmd->flags));
+    }
+
+    return target;
+}
+
+static void victim_oracle_log(VictimSession* session, const spectre_lab_command* cmd, int target, bool architectural)
+{
+    spectre_lab_oracle_record* record = &session->oracle[session->oracle_head % SHD_SPECTRE_LAB_ORACLE_LEN];
+    record->sequence = session->oracle_head++;
+    record->kind = cmd->kind;
+    record->flags = cmd->flags;
+    record->offset = cmd->arg2;
+    record->target = target;
+    record->architectural = architectural;
+}
+
+/*
+ * victim_handle_write
+ * Same parsing and validation as spectre_lab_victim_write.
+*/
+static ssize_t victim_handle_write(VictimSession* session, const char* buf, size_t len)
+{
+    spectre_lab_batch_header header;
+    spectre_lab_command cmd;
+    const char* next_cmd = buf;
+    size_t num_cmds = 1;
+
+    if (len < sizeof(cmd)) return 0;
+
+    memcpy(&header, buf, sizeof(header));
+    if (SHD_SPECTRE_LAB_BATCH_MAGIC == header.magic) {
+        if (header.count == 0 || header.count > SHD_SPECTRE_LAB_MAX_BATCH_LEN ||
+                len < sizeof(header) + header.count * sizeof(cmd)) {
+            fprintf(stderr, "Invalid batch of %u commands (%zu bytes)\n", header.count, len);
+            return len;
+        }
+        num_cmds = header.count;
+        next_cmd += sizeof(header);
+    }
+
+    for (size_t n = 0; n < num_cmds; n++) {
+        memcpy(&cmd, next_cmd + n * sizeof(cmd), sizeof(cmd));
+        char* region = (char*)cmd.arg1;
+
+        if (COMMAND_REGISTER_SHARED_MEMORY == cmd.kind) {
+            if (cmd.arg2 > SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES) {
+                fprintf(stderr, "Invalid user request- can't pin %lu pages\n", (unsigned long)cmd.arg2);
+                continue;
+            }
+            session->mapped_region = region;
+            session->num_pages = cmd.arg2 ? cmd.arg2 : SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES;
+            continue;
+        }
+        if (COMMAND_UNREGISTER_SHARED_MEMORY == cmd.kind) {
+            session->mapped_region = NULL;
+            continue;
+        }
+
+        if (region == NULL) {
+            fprintf(stderr, "Invalid user request- shared memory is %p\n", region);
+            break;
+        }
+        if (session->mapped_region != NULL && region != session->mapped_region) {
+            fprintf(stderr, "Command %zu uses a different shared memory region (%p) than the registered one (%p)\n",
+                n, region, session->mapped_region);
+            break;
+        }
+        size_t secret_len = (cmd.flags & SHD_SPECTRE_LAB_FLAG_STORE) ? victim_store_size : SHD_SPECTRE_LAB_SECRET_MAX_LEN;
+        if (!(cmd.arg2 < secret_len)) {
+            fprintf(stderr, "Tried to access a secret that is too large! Requested offset %lu\n", (unsigned long)cmd.arg2);
+            break;
+        }
+        size_t num_pages = session->mapped_region != NULL ? session->num_pages : SHD_SPECTRE_LAB_SHARED_MEMORY_NUM_PAGES;
+        if (!SHD_SPECTRE_LAB_FIELD_VALID(cmd.flags) || SHD_SPECTRE_LAB_FIELD_LINES(cmd.flags) > num_pages) {
+            fprintf(stderr, "Invalid bit-field (flags 0x%X) for %zu mapped pages\n", cmd.flags, num_pages);
+            break;
+        }
+
+        bool architectural;
+        int target = victim_run_command(&cmd, region, &architectural, session->oracle != NULL);
+        if (session->oracle != NULL) {
+            victim_oracle_log(session, &cmd, target, architectural);
+        }
+    }
+    return len;
+}
+
+/*
+ * victim_thread
+ * Serves one socket: runs every packet it receives, then acknowledges it with one byte.
+ * Exits when the attacker closes its end.
+*/
+static void* victim_thread(void* arg)
+{
+    // Only touched here while the attacker waits for our ack, so no locking is needed
+    VictimSession* session = arg;
+    int sock = session->victim_socket;
+    char buf[VICTIM_MAX_WRITE];
+    ssize_t len;
+
+    while ((len = read(sock, buf, sizeof(buf))) > 0) {
+        char ack = 1;
+        victim_handle_write(session, buf, len);
+        if (write(sock, &ack, 1) != 1) break;
+    }
+    close(sock);
+    return NULL;
+}
+
+static int open_victim_thread(void)
+{
+    int sockets[2];
+    pthread_t thread;
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+
+    // SOCK_SEQPACKET keeps each write() (a command or batch) in one read()
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) != 0) return -1;
+    if (sockets[0] >= VICTIM_MAX_FDS) {
+        close(sockets[0]);
+        close(sockets[1]);
+        errno = EMFILE;
+        return -1;
+    }
+
+    // Run the gadgets on our core, like the module does for a write() from this thread
+    pthread_attr_init(&attr);
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    victim_sessions[sockets[0]] = (VictimSession) { .mode = VICTIM_THREAD, .victim_socket = sockets[1] };
+    if (pthread_create(&thread, &attr, victim_thread, &victim_sessions[sockets[0]]) != 0) {
+        pthread_attr_destroy(&attr);
+        victim_sessions[sockets[0]] = (VictimSession) { .mode = VICTIM_KERNEL };
+        close(sockets[0]);
+        close(sockets[1]);
+        return -1;
+    }
+    pthread_attr_destroy(&attr);
+
+    return sockets[0];
+}
+
+static int open_victim_direct(void)
+{
+    // Only used as a handle into victim_sessions
+    int fd = open("/dev/null", O_RDWR);
+    if (fd < 0) return -1;
+    if (fd >= VICTIM_MAX_FDS) {
+        close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+
+    victim_sessions[fd] = (VictimSession) { .mode = VICTIM_DIRECT, .mapped_region = NULL };
+    return fd;
+}
+
+int open_victim(VictimMode mode)
+{
+    switch (mode) {
+        case VICTIM_THREAD: return open_victim_thread();
+        case VICTIM_DIRECT: return open_victim_direct();
+        default: break;
+    }
+
+    int fd = open("/proc/" SHD_PROCFS_NAME, O_RDWR);
+    if (fd >= 0 && fd < VICTIM_MAX_FDS) {
+        victim_sessions[fd] = (VictimSession) { .mode = VICTIM_KERNEL };
+    }
+    return fd;
+}
+
+ssize_t victim_write(int fd, const void* buf, size_t len)
+{
+    VictimMode mode = fd >= 0 && fd < VICTIM_MAX_FDS ? victim_sessions[fd].mode : VICTIM_KERNEL;
+    char ack;
+
+    switch (mode) {
+        case VICTIM_DIRECT:
+            return victim_handle_write(&victim_sessions[fd], buf, len);
+
+        case VICTIM_THREAD:
+            // Wait for the victim to finish, so the caller can probe right after
+            if (write(fd, buf, len) != (ssize_t)len) return -1;
+            if (read(fd, &ack, 1) != 1) return -1;
+            return len;
+
+        default:
+            return write(fd, buf, len);
+    }
+}
+
+bool enable_victim_oracle(int fd)
+{
+    VictimSession* session = fd >= 0 && fd < VICTIM_MAX_FDS ? &victim_sessions[fd] : NULL;
+    char value = 'N';
+
+    if (session != NULL && session->mode != VICTIM_KERNEL) {
+        if (session->oracle == NULL) {
+            session->oracle = calloc(SHD_SPECTRE_LAB_ORACLE_LEN, sizeof(spectre_lab_oracle_record));
+        }
+        return session->oracle != NULL;
+    }
+
+    // The module only logs when it was loaded with oracle_mode=1 (or root turned it on since)
+    FILE* param = fopen(VICTIM_ORACLE_PARAM, "r");
+    if (param == NULL) return false;
+    if (fread(&value, 1, 1, param) != 1) value = 'N';
+    fclose(param);
+    return value == 'Y';
+}
+
+size_t read_victim_oracle(int fd, spectre_lab_oracle_record* records, size_t max_records)
+{
+    VictimSession* session = fd >= 0 && fd < VICTIM_MAX_FDS ? &victim_sessions[fd] : NULL;
+    size_t n = 0;
+
+    if (session == NULL || session->mode == VICTIM_KERNEL) {
+        ssize_t len = read(fd, records, max_records * sizeof(spectre_lab_oracle_record));
+        return len > 0 ? len / sizeof(spectre_lab_oracle_record) : 0;
+    }
+    if (session->oracle == NULL) return 0;
+
+    if (session->oracle_head - session->oracle_tail > SHD_SPECTRE_LAB_ORACLE_LEN) {
+        session->oracle_tail = session->oracle_head - SHD_SPECTRE_LAB_ORACLE_LEN;
+    }
+    while (n < max_records && session->oracle_tail < session->oracle_head) {
+        records[n++] = session->oracle[session->oracle_tail++ % SHD_SPECTRE_LAB_ORACLE_LEN];
+    }
+    return n;
+}
+
+bool configure_secret_store(VictimMode mode, size_t size, uint64_t seed)
+{
+    size_t current_size;
+    unsigned long long current_seed;
+
+    if (mode != VICTIM_KERNEL) {
+        if (size > SHD_SPECTRE_LAB_STORE_MAX_SIZE) return false;
+        char* store = size > 0 ? malloc(size) : NULL;
+        if (size > 0 && store == NULL) return false;
+        for (size_t i = 0; i < size; i++) {
+            store[i] = shd_spectre_lab_store_byte(seed, i);
+        }
+        free((void*)victim_store);
+        victim_store = store;
+        victim_store_size = size;
+        return true;
+    }
+
+    // Leave a store that already matches alone, so a module loaded with it needs no root
+    FILE* f = fopen(VICTIM_STORE_PROCFS, "r");
+    if (f == NULL) return false;
+    bool matches = fscanf(f, "%zu %llu", &current_size, &current_seed) == 2 &&
+        current_size == size && current_seed == seed;
+    fclose(f);
+    if (matches) return true;
+
+    f = fopen(VICTIM_STORE_PROCFS, "w");
+    if (f == NULL) return false;
+    fprintf(f, "%zu %llu\n", size, (unsigned long long)seed);
+    return fclose(f) == 0;
+}
+
+void close_victim(int fd)
+{
+    if (fd >= 0 && fd < VICTIM_MAX_FDS) {
+        free(victim_sessions[fd].oracle);
+        victim_sessions[fd] = (VictimSession) { .mode = VICTIM_KERNEL };
+    }
+    close(fd);
+}
@@ -0,0 +1,54 @@
+/*
+ * test_decision
+ * Checks the sign test behind decision_evaluate, in particular that near ties
+ * stay undecided once the hit counts get large.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "spectre_decision.h"
+
+static int failures = 0;
+
+static DecisionResult evaluate(uint32_t leader_hits, uint32_t runner_up_hits)
+{
+    DecisionConfig config = default_decision_config(100);
+    DecisionAccumulator acc;
+    decision_reset(&acc, PROBE_NUM_LINES);
+    acc.sweeps = leader_hits + runner_up_hits;
+    acc.hits[3] = leader_hits;
+    acc.hit_latency[3] = 50ULL * leader_hits;
+    acc.hits[7] = runner_up_hits;
+    acc.hit_latency[7] = 50ULL * runner_up_hits;
+    return decision_evaluate(&acc, &config);
+}
+
+static void expect(uint32_t leader_hits, uint32_t runner_up_hits, bool decided, double min_confidence, double max_confidence)
+{
+    DecisionResult result = evaluate(leader_hits, runner_up_hits);
+    bool ok = result.decided == decided && result.confidence >= min_confidence && result.confidence <= max_confidence;
+    printf("%s %u vs %u: %s, confidence %.6f\n", ok ? "PASS" : "FAIL", leader_hits, runner_up_hits,
+        result.decided ? "decided" : "undecided", result.confidence);
+    if (!ok) failures++;
+}
+
+int main()
+{
+    // Small counts: 10 vs 0 has p = 2^-10
+    expect(10, 0, true, 1.0 - 1.0 / 1024 - 1e-9, 1.0 - 1.0 / 1024 + 1e-9);
+    expect(3, 2, false, 0.0, 0.6);
+
+    // Near ties past n = 1074, where 2^-n underflows a double
+    expect(538, 537, false, 0.0, 0.6);
+    expect(540, 540, false, 0.0, 0.6);
+    expect(5000, 4950, false, 0.0, 0.75);
+    expect(20000, 19990, false, 0.0, 0.6);
+
+    // Clear winners at large counts are still decided
+    expect(1200, 1000, true, 0.99, 1.0);
+    expect(10000, 100, true, 0.99, 1.0);
+
+    printf("%s\n", failures == 0 ? "All decision tests passed" : "Decision tests FAILED");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}